@@ -0,0 +1,423 @@
+#include "CompressedMesh3D.hpp"
+#include "MappedFile.hpp"
+#include "universal_error.hpp"
+#include <boost/cstdint.hpp>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+	char const compressed_magic[8] = { 'R', 'I', 'C', 'H', '3', 'D', 'C', 0 };
+	boost::uint64_t const endian_marker = 0x0102030405060708ULL;
+	// Values per chunk, a multiple of 3 so that coordinate chunks start with an x value
+	std::size_t const chunk_size = 3 * 32768;
+
+	typedef vector<unsigned char> ByteVector;
+	typedef std::pair<unsigned char const*, unsigned char const*> ByteRange;
+
+	boost::uint64_t ZigZag(boost::int64_t value)
+	{
+		return (static_cast<boost::uint64_t>(value) << 1) ^ static_cast<boost::uint64_t>(value >> 63);
+	}
+
+	boost::int64_t UnZigZag(boost::uint64_t value)
+	{
+		return static_cast<boost::int64_t>(value >> 1) ^ -static_cast<boost::int64_t>(value & 1);
+	}
+
+	void PutVarint(ByteVector &out, boost::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<unsigned char>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<unsigned char>(value));
+	}
+
+	boost::uint64_t GetVarint(unsigned char const* &ptr, unsigned char const* end)
+	{
+		boost::uint64_t res = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (ptr >= end)
+				throw UniversalError("Truncated chunk in compressed mesh file");
+			unsigned char const byte = *ptr++;
+			res |= static_cast<boost::uint64_t>(byte & 0x7F) << shift;
+			if (byte < 0x80)
+				return res;
+		}
+		throw UniversalError("Bad varint in compressed mesh file");
+	}
+
+	void EncodeIndeces(boost::uint64_t const* data, std::size_t N, bool delta, ByteVector &out)
+	{
+		out.reserve(N * 2);
+		boost::uint64_t prev = 0;
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (delta)
+			{
+				PutVarint(out, ZigZag(static_cast<boost::int64_t>(data[i] - prev)));
+				prev = data[i];
+			}
+			else
+				PutVarint(out, data[i]);
+		}
+	}
+
+	void DecodeIndeces(ByteRange const& in, std::size_t N, bool delta, boost::uint64_t *data)
+	{
+		unsigned char const* ptr = in.first;
+		boost::uint64_t prev = 0;
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			boost::uint64_t const value = GetVarint(ptr, in.second);
+			if (delta)
+			{
+				prev += static_cast<boost::uint64_t>(UnZigZag(value));
+				data[i] = prev;
+			}
+			else
+				data[i] = value;
+		}
+	}
+
+	void EncodeCoordinates(double const* data, std::size_t N, double quantization, double const* origin,
+		ByteVector &out)
+	{
+		out.reserve(N * 4);
+		boost::uint64_t prev[3] = { 0, 0, 0 };
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			boost::uint64_t bits;
+			if (quantization > 0)
+			{
+				bits = static_cast<boost::uint64_t>(static_cast<boost::int64_t>(
+					std::floor((data[i] - origin[i % 3]) / quantization + 0.5)));
+				PutVarint(out, ZigZag(static_cast<boost::int64_t>(bits - prev[i % 3])));
+			}
+			else
+			{
+				std::memcpy(&bits, &data[i], sizeof(double));
+				boost::uint64_t const x = bits ^ prev[i % 3];
+				unsigned char nbytes = 0;
+				while (nbytes < 8 && (x >> (8 * nbytes)) != 0)
+					++nbytes;
+				out.push_back(nbytes);
+				for (unsigned char j = 0; j < nbytes; ++j)
+					out.push_back(static_cast<unsigned char>(x >> (8 * j)));
+			}
+			prev[i % 3] = bits;
+		}
+	}
+
+	void DecodeCoordinates(ByteRange const& in, std::size_t N, double quantization, double const* origin,
+		double *data)
+	{
+		unsigned char const* ptr = in.first;
+		boost::uint64_t prev[3] = { 0, 0, 0 };
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (quantization > 0)
+			{
+				prev[i % 3] += static_cast<boost::uint64_t>(UnZigZag(GetVarint(ptr, in.second)));
+				data[i] = origin[i % 3] + quantization * static_cast<double>(static_cast<boost::int64_t>(prev[i % 3]));
+			}
+			else
+			{
+				if (ptr >= in.second || *ptr > 8 || in.second - ptr <= *ptr)
+					throw UniversalError("Truncated chunk in compressed mesh file");
+				unsigned char const nbytes = *ptr++;
+				boost::uint64_t x = 0;
+				for (unsigned char j = 0; j < nbytes; ++j)
+					x |= static_cast<boost::uint64_t>(*ptr++) << (8 * j);
+				prev[i % 3] ^= x;
+				std::memcpy(&data[i], &prev[i % 3], sizeof(double));
+			}
+		}
+	}
+
+	void WriteChunks(std::ofstream &fh, vector<ByteVector> const& chunks, std::size_t Nvalues)
+	{
+		vector<boost::uint64_t> header(2 + chunks.size());
+		header[0] = Nvalues;
+		header[1] = chunks.size();
+		for (std::size_t i = 0; i < chunks.size(); ++i)
+			header[i + 2] = chunks[i].size();
+		fh.write(reinterpret_cast<const char*>(&header[0]), static_cast<std::streamsize>(header.size() *
+			sizeof(boost::uint64_t)));
+		for (std::size_t i = 0; i < chunks.size(); ++i)
+			if (!chunks[i].empty())
+				fh.write(reinterpret_cast<const char*>(&chunks[i][0]), static_cast<std::streamsize>(chunks[i].size()));
+	}
+
+	void WriteIndexSection(std::ofstream &fh, vector<boost::uint64_t> const& data, bool delta)
+	{
+		vector<ByteVector> chunks((data.size() + chunk_size - 1) / chunk_size);
+		long const Nchunks = static_cast<long>(chunks.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (long i = 0; i < Nchunks; ++i)
+		{
+			std::size_t const start = static_cast<std::size_t>(i) * chunk_size;
+			EncodeIndeces(&data[start], std::min(chunk_size, data.size() - start), delta,
+				chunks[static_cast<std::size_t>(i)]);
+		}
+		WriteChunks(fh, chunks, data.size());
+	}
+
+	void WriteCoordinateSection(std::ofstream &fh, vector<double> const& data, double quantization,
+		double const* origin)
+	{
+		vector<ByteVector> chunks((data.size() + chunk_size - 1) / chunk_size);
+		long const Nchunks = static_cast<long>(chunks.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (long i = 0; i < Nchunks; ++i)
+		{
+			std::size_t const start = static_cast<std::size_t>(i) * chunk_size;
+			EncodeCoordinates(&data[start], std::min(chunk_size, data.size() - start), quantization, origin,
+				chunks[static_cast<std::size_t>(i)]);
+		}
+		WriteChunks(fh, chunks, data.size());
+	}
+
+	boost::uint64_t ReadUint64(unsigned char const* &ptr, unsigned char const* end)
+	{
+		boost::uint64_t res = 0;
+		if (end - ptr < static_cast<std::ptrdiff_t>(sizeof(boost::uint64_t)))
+			throw UniversalError("Truncated compressed mesh file");
+		std::memcpy(&res, ptr, sizeof(boost::uint64_t));
+		ptr += sizeof(boost::uint64_t);
+		return res;
+	}
+
+	std::size_t ReadChunks(unsigned char const* &ptr, unsigned char const* end, vector<ByteRange> &chunks)
+	{
+		std::size_t const Nvalues = static_cast<std::size_t>(ReadUint64(ptr, end));
+		std::size_t const Nchunks = static_cast<std::size_t>(ReadUint64(ptr, end));
+		if (Nchunks != (Nvalues + chunk_size - 1) / chunk_size)
+			throw UniversalError("Bad chunk count in compressed mesh file");
+		vector<boost::uint64_t> sizes(Nchunks);
+		for (std::size_t i = 0; i < Nchunks; ++i)
+			sizes[i] = ReadUint64(ptr, end);
+		chunks.resize(Nchunks);
+		for (std::size_t i = 0; i < Nchunks; ++i)
+		{
+			if (static_cast<boost::uint64_t>(end - ptr) < sizes[i])
+				throw UniversalError("Truncated compressed mesh file");
+			chunks[i] = ByteRange(ptr, ptr + sizes[i]);
+			ptr += sizes[i];
+		}
+		return Nvalues;
+	}
+
+	vector<boost::uint64_t> ReadIndexSection(unsigned char const* &ptr, unsigned char const* end, bool delta)
+	{
+		vector<ByteRange> chunks;
+		vector<boost::uint64_t> res(ReadChunks(ptr, end, chunks));
+		long const Nchunks = static_cast<long>(chunks.size());
+		bool failed = false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (long i = 0; i < Nchunks; ++i)
+		{
+			std::size_t const start = static_cast<std::size_t>(i) * chunk_size;
+			try
+			{
+				DecodeIndeces(chunks[static_cast<std::size_t>(i)], std::min(chunk_size, res.size() - start), delta,
+					&res[start]);
+			}
+			catch (UniversalError const&)
+			{
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+				failed = true;
+			}
+		}
+		if (failed)
+			throw UniversalError("Corrupt chunk in compressed mesh file");
+		return res;
+	}
+
+	vector<double> ReadCoordinateSection(unsigned char const* &ptr, unsigned char const* end, double quantization,
+		double const* origin)
+	{
+		vector<ByteRange> chunks;
+		vector<double> res(ReadChunks(ptr, end, chunks));
+		long const Nchunks = static_cast<long>(chunks.size());
+		bool failed = false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (long i = 0; i < Nchunks; ++i)
+		{
+			std::size_t const start = static_cast<std::size_t>(i) * chunk_size;
+			try
+			{
+				DecodeCoordinates(chunks[static_cast<std::size_t>(i)], std::min(chunk_size, res.size() - start),
+					quantization, origin, &res[start]);
+			}
+			catch (UniversalError const&)
+			{
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+				failed = true;
+			}
+		}
+		if (failed)
+			throw UniversalError("Corrupt chunk in compressed mesh file");
+		return res;
+	}
+
+	vector<double> Flatten(vector<Vector3D> const& points, std::size_t N)
+	{
+		vector<double> res(3 * N);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			res[3 * i] = points[i].x;
+			res[3 * i + 1] = points[i].y;
+			res[3 * i + 2] = points[i].z;
+		}
+		return res;
+	}
+
+	vector<Vector3D> Unflatten(vector<double> const& data)
+	{
+		vector<Vector3D> res(data.size() / 3);
+		for (std::size_t i = 0; i < res.size(); ++i)
+			res[i] = Vector3D(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+		return res;
+	}
+
+	vector<vector<std::size_t> > SplitCSR(vector<boost::uint64_t> const& counts, vector<boost::uint64_t> const& data)
+	{
+		vector<vector<std::size_t> > res(counts.size());
+		std::size_t loc = 0;
+		for (std::size_t i = 0; i < counts.size(); ++i)
+		{
+			if (counts[i] > data.size() - loc)
+				throw UniversalError("Bad counts in compressed mesh file");
+			res[i].assign(data.begin() + static_cast<std::ptrdiff_t>(loc),
+				data.begin() + static_cast<std::ptrdiff_t>(loc + counts[i]));
+			loc += static_cast<std::size_t>(counts[i]);
+		}
+		if (loc != data.size())
+			throw UniversalError("Bad counts in compressed mesh file");
+		return res;
+	}
+}
+
+void WriteCompressedMesh3D(Tessellation3D const& tess, std::string const& filename, double quantization)
+{
+	std::size_t const Ncells = tess.GetPointNo();
+	std::size_t const Nfaces = tess.GetTotalFacesNumber();
+	vector<double> points(3 * Ncells);
+	for (std::size_t i = 0; i < Ncells; ++i)
+	{
+		Vector3D const point = tess.GetMeshPoint(i);
+		points[3 * i] = point.x;
+		points[3 * i + 1] = point.y;
+		points[3 * i + 2] = point.z;
+	}
+	vector<double> vertices = Flatten(tess.GetFacePoints(), tess.GetFacePoints().size());
+
+	// The grid origin is the lower corner of all the coordinates
+	double origin[3] = { 0, 0, 0 };
+	if (quantization > 0)
+	{
+		origin[0] = origin[1] = origin[2] = std::numeric_limits<double>::max();
+		for (std::size_t i = 0; i < points.size(); ++i)
+			origin[i % 3] = std::min(origin[i % 3], points[i]);
+		for (std::size_t i = 0; i < vertices.size(); ++i)
+			origin[i % 3] = std::min(origin[i % 3], vertices[i]);
+	}
+	else
+		quantization = 0;
+
+	vector<boost::uint64_t> cell_counts(Ncells), cell_faces;
+	for (std::size_t i = 0; i < Ncells; ++i)
+	{
+		vector<std::size_t> const& faces = tess.GetCellFaces(i);
+		cell_counts[i] = faces.size();
+		cell_faces.insert(cell_faces.end(), faces.begin(), faces.end());
+	}
+	vector<boost::uint64_t> face_counts(Nfaces), face_points, face_neighbors(2 * Nfaces);
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		vector<std::size_t> const& findex = tess.GetPointsInFace(i);
+		face_counts[i] = findex.size();
+		face_points.insert(face_points.end(), findex.begin(), findex.end());
+		std::pair<std::size_t, std::size_t> const neigh = tess.GetFaceNeighbors(i);
+		face_neighbors[2 * i] = neigh.first;
+		face_neighbors[2 * i + 1] = neigh.second;
+	}
+
+	std::ofstream fh(filename.c_str(), std::ios::binary);
+	if (!fh.good())
+		throw UniversalError("Can't open file " + filename);
+	fh.write(compressed_magic, sizeof(compressed_magic));
+	boost::uint64_t header[2] = { COMPRESSEDMESH3D_VERSION, endian_marker };
+	fh.write(reinterpret_cast<const char*>(header), sizeof(header));
+	double grid[4] = { quantization, origin[0], origin[1], origin[2] };
+	fh.write(reinterpret_cast<const char*>(grid), sizeof(grid));
+	WriteCoordinateSection(fh, points, quantization, origin);
+	WriteCoordinateSection(fh, vertices, quantization, origin);
+	WriteIndexSection(fh, cell_counts, false);
+	WriteIndexSection(fh, cell_faces, true);
+	WriteIndexSection(fh, face_counts, false);
+	WriteIndexSection(fh, face_points, true);
+	WriteIndexSection(fh, face_neighbors, true);
+	if (!fh.good())
+		throw UniversalError("Failed writing compressed mesh file " + filename);
+	fh.close();
+}
+
+MeshData3D ReadCompressedMesh3D(std::string const& filename)
+{
+	MappedFile file(filename);
+	unsigned char const* ptr = reinterpret_cast<unsigned char const*>(file.GetData());
+	unsigned char const* end = ptr + file.GetSize();
+	if (file.GetSize() < sizeof(compressed_magic) || std::memcmp(ptr, compressed_magic, sizeof(compressed_magic)) != 0)
+		throw UniversalError("Not a compressed mesh file " + filename);
+	ptr += sizeof(compressed_magic);
+	boost::uint64_t const version = ReadUint64(ptr, end);
+	if (version != COMPRESSEDMESH3D_VERSION)
+	{
+		UniversalError eo("Unsupported compressed mesh file version");
+		eo.AddEntry("Version", static_cast<double>(version));
+		throw eo;
+	}
+	if (ReadUint64(ptr, end) != endian_marker)
+		throw UniversalError("Compressed mesh file was written with a different byte order " + filename);
+	double grid[4];
+	if (end - ptr < static_cast<std::ptrdiff_t>(sizeof(grid)))
+		throw UniversalError("Truncated compressed mesh file " + filename);
+	std::memcpy(grid, ptr, sizeof(grid));
+	ptr += sizeof(grid);
+
+	MeshData3D res;
+	res.points = Unflatten(ReadCoordinateSection(ptr, end, grid[0], grid + 1));
+	res.vertices = Unflatten(ReadCoordinateSection(ptr, end, grid[0], grid + 1));
+	vector<boost::uint64_t> counts = ReadIndexSection(ptr, end, false);
+	res.cell_faces = SplitCSR(counts, ReadIndexSection(ptr, end, true));
+	counts = ReadIndexSection(ptr, end, false);
+	res.face_points = SplitCSR(counts, ReadIndexSection(ptr, end, true));
+	vector<boost::uint64_t> neighbors = ReadIndexSection(ptr, end, true);
+	if (res.cell_faces.size() != res.points.size() || neighbors.size() != 2 * res.face_points.size())
+		throw UniversalError("Inconsistent compressed mesh file " + filename);
+	res.face_neighbors.resize(res.face_points.size());
+	for (std::size_t i = 0; i < res.face_neighbors.size(); ++i)
+		res.face_neighbors[i] = std::pair<std::size_t, std::size_t>(static_cast<std::size_t>(neighbors[2 * i]),
+			static_cast<std::size_t>(neighbors[2 * i + 1]));
+	return res;
+}
@@ -0,0 +1,44 @@
+/*! \file CompressedMesh3D.hpp
+\brief Compressed mesh output, the connectivity is delta and varint encoded and the coordinates are either quantized or XOR delta encoded
+\author Elad Steinberg
+*/
+
+#ifndef COMPRESSEDMESH3D_HPP
+#define COMPRESSEDMESH3D_HPP 1
+
+#include <string>
+#include "Tessellation3D.hpp"
+
+//! \brief The version of the compressed mesh format
+#define COMPRESSEDMESH3D_VERSION 1
+
+//! \brief Mesh data as read from a compressed mesh file
+struct MeshData3D
+{
+	//! \brief The mesh points
+	vector<Vector3D> points;
+	//! \brief The face vertices
+	vector<Vector3D> vertices;
+	//! \brief The faces of each cell
+	vector<vector<std::size_t> > cell_faces;
+	//! \brief The vertices of each face
+	vector<vector<std::size_t> > face_points;
+	//! \brief The neighbors of each face
+	vector<std::pair<std::size_t, std::size_t> > face_neighbors;
+};
+
+/*! \brief Writes a tessellation in compressed form
+\details Every section is split into chunks that are encoded independently, by OpenMP threads when they are enabled. Indeces are stored as zigzag varints of the difference from the previous index, which is small only when neighboring cells and faces have close indeces. The writer keeps the order of the tessellation, so for a good compression ratio call Voronoi3D::Reorder before writing. Coordinates are either rounded to a grid and delta encoded, or stored losslessly as the XOR with the previous value of the same axis without its leading zero bytes.
+\param tess The tessellation
+\param filename The name of the file
+\param quantization The grid spacing for the coordinates, zero for lossless coordinates
+*/
+void WriteCompressedMesh3D(Tessellation3D const& tess, std::string const& filename, double quantization = 0);
+
+/*! \brief Reads a file written by WriteCompressedMesh3D
+\param filename The name of the file
+\return The mesh data
+*/
+MeshData3D ReadCompressedMesh3D(std::string const& filename);
+
+#endif //COMPRESSEDMESH3D_HPP
@@ -0,0 +1,86 @@
+#include "ConstNumberPerProc3D.hpp"
+
+#ifdef RICH_MPI
+#include <mpi.h>
+#include <algorithm>
+
+namespace
+{
+	double ClampToRange(double x, double low, double high)
+	{
+		return std::max(low, std::min(high, x));
+	}
+}
+
+ConstNumberPerProc3D::ConstNumberPerProc3D(double speed, double RoundSpeed, bool time_weighted) :
+	speed_(speed), RoundSpeed_(RoundSpeed), time_weighted_(time_weighted)
+{}
+
+void ConstNumberPerProc3D::Update(Voronoi3D &tproc, Voronoi3D const& tlocal) const
+{
+	int rank = 0, nproc = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	std::size_t const Nproc = static_cast<std::size_t>(nproc);
+	std::size_t const myrank = static_cast<std::size_t>(rank);
+
+	// Gather the work of all the processors
+	double load = time_weighted_ ? tlocal.GetBuildTime() : static_cast<double>(tlocal.GetPointNo());
+	vector<double> loads(Nproc, 0);
+	MPI_Allgather(&load, 1, MPI_DOUBLE, &loads[0], 1, MPI_DOUBLE, MPI_COMM_WORLD);
+
+	Vector3D point = tproc.GetMeshPoint(myrank);
+	double const R = tproc.GetWidth(myrank);
+
+	// Lloyd term, move towards the center of mass of the local cells
+	std::size_t const Nlocal = tlocal.GetPointNo();
+	Vector3D dx;
+	if (Nlocal > 0)
+	{
+		Vector3D CM;
+		for (std::size_t i = 0; i < Nlocal; ++i)
+			CM += tlocal.GetMeshPoint(i);
+		CM = CM / static_cast<double>(Nlocal);
+		dx = RoundSpeed_ * (CM - point);
+	}
+
+	// Weighted term, move away from neighbors that have less work and towards neighbors that have more
+	vector<std::size_t> neigh = tproc.GetNeighbors(myrank);
+	for (std::size_t i = 0; i < neigh.size(); ++i)
+	{
+		if (neigh[i] >= Nproc)
+			continue;
+		double const total = loads[myrank] + loads[neigh[i]];
+		if (total <= 0)
+			continue;
+		Vector3D const diff = point - tproc.GetMeshPoint(neigh[i]);
+		double const dist = abs(diff);
+		if (dist <= 0)
+			continue;
+		dx += (speed_ * R * (loads[myrank] - loads[neigh[i]]) / total) * diff / dist;
+	}
+
+	// Limit the step
+	double const step = abs(dx);
+	if (step > speed_ * R)
+		dx = dx * (speed_ * R / step);
+	point += dx;
+
+	// Keep the point strictly inside the box
+	std::pair<Vector3D, Vector3D> const box = tproc.GetBoxCoordinates();
+	Vector3D const margin = 1e-6 * (box.second - box.first);
+	point.x = ClampToRange(point.x, box.first.x + margin.x, box.second.x - margin.x);
+	point.y = ClampToRange(point.y, box.first.y + margin.y, box.second.y - margin.y);
+	point.z = ClampToRange(point.z, box.first.z + margin.z, box.second.z - margin.z);
+
+	// Share the new points and rebuild
+	double send[3] = { point.x, point.y, point.z };
+	vector<double> recv(3 * Nproc, 0);
+	MPI_Allgather(send, 3, MPI_DOUBLE, &recv[0], 3, MPI_DOUBLE, MPI_COMM_WORLD);
+	vector<Vector3D> new_points(Nproc);
+	for (std::size_t i = 0; i < Nproc; ++i)
+		new_points[i] = Vector3D(recv[3 * i], recv[3 * i + 1], recv[3 * i + 2]);
+	tproc.Build(new_points);
+}
+
+#endif //RICH_MPI
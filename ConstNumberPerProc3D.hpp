@@ -0,0 +1,39 @@
+/*! \file ConstNumberPerProc3D.hpp
+\brief Load balancing of the processor domains by moving the processor generating points
+\author Elad Steinberg
+*/
+
+#ifndef CONST_NUMBER_PER_PROC3D_HPP
+#define CONST_NUMBER_PER_PROC3D_HPP 1
+
+#include "Voronoi3D.hpp"
+
+#ifdef RICH_MPI
+
+/*! \brief Moves the processor generating points so that the work per processor becomes even
+\details Every processor moves its point towards the center of mass of its cells (Lloyd iteration) and away from neighboring processors that have less work than it does (weighted Voronoi iteration). The work is either the number of cells or the time measured inside Voronoi3D::Build.
+*/
+class ConstNumberPerProc3D
+{
+public:
+	/*! \brief Class constructor
+	\param speed The maximum displacement of a processor point per update in units of the processor cell width
+	\param RoundSpeed The fraction of the distance to the center of mass of the local cells that the processor point moves per update
+	\param time_weighted True to balance the measured build time, false to balance the number of cells
+	*/
+	ConstNumberPerProc3D(double speed = 0.03, double RoundSpeed = 0.2, bool time_weighted = false);
+
+	/*! \brief Updates the processor tessellation, this is a collective call
+	\param tproc The processor tessellation, rebuilt with the new processor points
+	\param tlocal The local tessellation of this processor from the last build
+	*/
+	void Update(Voronoi3D &tproc, Voronoi3D const& tlocal) const;
+
+private:
+	const double speed_;
+	const double RoundSpeed_;
+	const bool time_weighted_;
+};
+
+#endif //RICH_MPI
+#endif //CONST_NUMBER_PER_PROC3D_HPP
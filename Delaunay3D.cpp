@@ -4,18 +4,32 @@
 #include <algorithm>
 #include <fstream>
 #include "HilbertOrder3D.hpp"
+#include "universal_error.hpp"
+#include <boost/cstdint.hpp>
+#include <boost/container/flat_set.hpp>
+#include <boost/container/small_vector.hpp>
 
 //#define runcheks 1
 
 namespace
 {
-	Vector3D PlaneLineIntersection(boost::array<Vector3D, 3> const& plane, Vector3D const& A, Vector3D const& B)
+	boost::uint64_t const checkpoint_magic = 0x314C454448434952ULL; // "RICHDEL1"
+	boost::uint64_t const checkpoint_version = 1;
+
+	template<class T>
+	void WriteBulk(std::ostream &fh, vector<T> const& data)
 	{
-		Vector3D N = CrossProduct(plane[1] - plane[0], plane[2] - plane[0]);
-		Vector3D mu = B - A;
-		double m = ScalarProd(N, plane[0] - A) / ScalarProd(N, mu);
-		//assert(m > 0 && m < 1);
-		return A + m*mu;
+		if (!data.empty())
+			fh.write(reinterpret_cast<const char*>(&data[0]), static_cast<std::streamsize>(data.size() * sizeof(T)));
+	}
+
+	template<class T>
+	void ReadBulk(std::istream &fh, vector<T> &data)
+	{
+		if (!data.empty())
+			fh.read(reinterpret_cast<char*>(&data[0]), static_cast<std::streamsize>(data.size() * sizeof(T)));
+		if (!fh.good())
+			throw UniversalError("Truncated Delaunay3D checkpoint");
 	}
 
 	std::size_t GetOppositePoint(Tetrahedron const& tetra, std::size_t neighbor)
@@ -34,27 +48,6 @@ namespace
 		assert(false);
 	}
 
-	std::pair<std::size_t,double> InTriangle(boost::array<Vector3D, 3> const& triangle, Vector3D const& p)
-	{
-		// returns the smallest area of the cross product in units of the triangle area, negative if outside
-		Vector3D a = CrossProduct(triangle[1] - triangle[0], p - triangle[0]);
-		Vector3D b = CrossProduct(triangle[2] - triangle[1], p - triangle[1]);
-		Vector3D c = CrossProduct(triangle[0] - triangle[2], p - triangle[2]);
-		Vector3D d = CrossProduct(triangle[1] - triangle[0], triangle[2] - triangle[0]);
-		double ad = ScalarProd(d, a);
-		double bd = ScalarProd(d, b);
-		double cd = ScalarProd(d, c);
-		std::pair<std::size_t, double> res(0, 0);
-		if (ad < 0)
-			++res.first;
-		if (bd < 0)
-			++res.first;
-		if (cd < 0)
-			++res.first;
-		res.second = std::min(std::min(std::abs(ad), std::abs(bd)), std::abs(cd)) / (ScalarProd(d, d));
-		return res;
-	}
-
 	bool Are44(Tetrahedron const& T0, Tetrahedron const& T1, std::size_t loc_in_0, vector<Tetrahedron> const& tetras,
 		std::size_t &N3,std::size_t &N4)
 	{
@@ -157,6 +150,7 @@ void Delaunay3D::flip23(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 		tetras_[Nloc] = newtet;
 	else
 		tetras_.push_back(newtet);
+	SetPointTetra(Nloc);
 
 	newtet.points[0] =oldtet0.points[location0];
 	newtet.points[3] = tetras_[tetra1].points[location1];
@@ -204,6 +198,7 @@ void Delaunay3D::flip23(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 	}
 
 	tetras_[tetra0] = newtet;
+	SetPointTetra(tetra0);
 
 	newtet.points[0] = oldtet0.points[location0];
 	newtet.points[3] = tetras_[tetra1].points[location1];
@@ -251,6 +246,7 @@ void Delaunay3D::flip23(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 	}
 
 	tetras_[tetra1] = newtet;
+	SetPointTetra(tetra1);
 
 	to_check_.push(tetra0);
 	to_check_.push(tetra1);
@@ -302,6 +298,7 @@ void Delaunay3D::flip32(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 		newtet.neighbors[1] = temp;
 	}
 	tetras_[tetra0] = newtet;
+	SetPointTetra(tetra0);
 	
 	newtet.points[0] = old.points[location0];
 	newtet.points[1] = old.points[shared_loction];
@@ -330,6 +327,7 @@ void Delaunay3D::flip32(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 		newtet.neighbors[1] = temp;
 	}
 	tetras_[tetra1] = newtet;
+	SetPointTetra(tetra1);
 	to_check_.push(tetra0);
 	to_check_.push(tetra1);
 
@@ -360,8 +358,10 @@ void Delaunay3D::flip44(std::size_t tetra0, std::size_t tetra1, std::size_t loca
 	flip32(neigh0, neigh1, location0, shared_location);
 }
 
-Delaunay3D::Delaunay3D()
-{}
+Delaunay3D::Delaunay3D():on_face_(false), tetra_epoch_(0)
+{
+	insphere_tier_counts_.assign(0);
+}
 
 
 Delaunay3D::~Delaunay3D()
@@ -372,18 +372,37 @@ void Delaunay3D::BuildExtra(vector<Vector3D> const& points)
 	vector<std::size_t> order = HilbertOrder3D(points);
 	size_t Nstart = points_.size();
 	points_.insert(points_.end(), points.begin(), points.end());
+	point_tetra_.resize(points_.size(), 0);
 
 	assert(to_check_.empty());
 	for (std::size_t i = 0; i < points.size(); ++i)
 		InsertPoint(order[i]+Nstart);
 }
 
+void Delaunay3D::BuildExtra(vector<Vector3D> const& points, vector<std::size_t> const& seeds)
+{
+	assert(points.size() == seeds.size());
+	size_t Nstart = points_.size();
+	points_.insert(points_.end(), points.begin(), points.end());
+	point_tetra_.resize(points_.size(), 0);
+
+	assert(to_check_.empty());
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		// A seed freed by an earlier insertion is skipped and the walk starts from the last inserted point
+		if (empty_tetras_.find(seeds[i]) == empty_tetras_.end())
+			last_checked_ = seeds[i];
+		InsertPoint(i + Nstart);
+	}
+}
+
 void Delaunay3D::Build(vector<Vector3D> const & points, Vector3D const& maxv, Vector3D const& minv)
 {
 	std::size_t Norg = points.size();
 	Norg_ = Norg;
-	points_.reserve(static_cast<std::size_t>(std::pow(Norg,0.6666)*7));
-	points_ = points;
+	// Room for the large tetra and the ghost points, so they are added without copying the points again
+	points_.reserve(Norg + 4 + static_cast<std::size_t>(std::pow(Norg,0.6666)*7));
+	points_.assign(points.begin(), points.end());
 	// Create large tetra points
 	double factor = 50;
 	points_.push_back(Vector3D(minv.x - 1.01*factor * (maxv.x - minv.x), minv.y - factor * (maxv.y - minv.y), minv.z - factor * (maxv.z - minv.z)));
@@ -403,8 +422,12 @@ void Delaunay3D::Build(vector<Vector3D> const & points, Vector3D const& maxv, Ve
 	tetra.neighbors[3] = outside_neighbor_;
 	tetras_.reserve(Norg * 5);
 	tetras_.push_back(tetra);
+	point_tetra_.assign(Norg + 4, 0);
 	last_checked_ = 0;
 	vector<std::size_t> order = HilbertOrder3D(points);
+	hilbert_rank_.resize(Norg);
+	for (std::size_t i = 0; i < Norg; ++i)
+		hilbert_rank_[order[i]] = i;
 	
 	assert(to_check_.empty());
 	for (std::size_t i = 0; i < Norg; ++i)
@@ -442,6 +465,90 @@ void Delaunay3D::output(string const & filename) const
 	fh.close();
 }
 
+void Delaunay3D::WriteCheckpoint(std::ostream &fh) const
+{
+	vector<boost::uint64_t> header(8);
+	header[0] = checkpoint_magic;
+	header[1] = checkpoint_version;
+	header[2] = Norg_;
+	header[3] = outside_neighbor_ == std::numeric_limits<std::size_t>::max() ?
+		std::numeric_limits<boost::uint64_t>::max() : outside_neighbor_;
+	header[4] = last_checked_;
+	header[5] = points_.size();
+	header[6] = tetras_.size();
+	header[7] = empty_tetras_.size();
+	WriteBulk(fh, header);
+
+	vector<double> cor(3 * points_.size());
+	for (std::size_t i = 0; i < points_.size(); ++i)
+	{
+		cor[3 * i] = points_[i].x;
+		cor[3 * i + 1] = points_[i].y;
+		cor[3 * i + 2] = points_[i].z;
+	}
+	WriteBulk(fh, cor);
+
+	vector<boost::uint64_t> data(8 * tetras_.size());
+	for (std::size_t i = 0; i < tetras_.size(); ++i)
+		for (std::size_t j = 0; j < 4; ++j)
+		{
+			data[8 * i + j] = tetras_[i].points[j];
+			data[8 * i + 4 + j] = tetras_[i].neighbors[j] == outside_neighbor_ ?
+				std::numeric_limits<boost::uint64_t>::max() : tetras_[i].neighbors[j];
+		}
+	WriteBulk(fh, data);
+
+	data.assign(empty_tetras_.begin(), empty_tetras_.end());
+	WriteBulk(fh, data);
+	if (!fh.good())
+		throw UniversalError("Failed writing Delaunay3D checkpoint");
+}
+
+void Delaunay3D::ReadCheckpoint(std::istream &fh)
+{
+	vector<boost::uint64_t> header(8);
+	ReadBulk(fh, header);
+	if (header[0] != checkpoint_magic)
+		throw UniversalError("Not a Delaunay3D checkpoint");
+	if (header[1] != checkpoint_version)
+	{
+		UniversalError eo("Unsupported Delaunay3D checkpoint version");
+		eo.AddEntry("Version", static_cast<double>(header[1]));
+		throw eo;
+	}
+	outside_neighbor_ = std::numeric_limits<std::size_t>::max();
+	Norg_ = static_cast<std::size_t>(header[2]);
+	last_checked_ = static_cast<std::size_t>(header[4]);
+
+	vector<double> cor(static_cast<std::size_t>(3 * header[5]));
+	ReadBulk(fh, cor);
+	points_.resize(static_cast<std::size_t>(header[5]));
+	for (std::size_t i = 0; i < points_.size(); ++i)
+		points_[i] = Vector3D(cor[3 * i], cor[3 * i + 1], cor[3 * i + 2]);
+
+	vector<boost::uint64_t> data(static_cast<std::size_t>(8 * header[6]));
+	ReadBulk(fh, data);
+	tetras_.resize(static_cast<std::size_t>(header[6]));
+	for (std::size_t i = 0; i < tetras_.size(); ++i)
+		for (std::size_t j = 0; j < 4; ++j)
+		{
+			tetras_[i].points[j] = static_cast<std::size_t>(data[8 * i + j]);
+			tetras_[i].neighbors[j] = data[8 * i + 4 + j] == std::numeric_limits<boost::uint64_t>::max() ?
+				outside_neighbor_ : static_cast<std::size_t>(data[8 * i + 4 + j]);
+		}
+
+	data.resize(static_cast<std::size_t>(header[7]));
+	ReadBulk(fh, data);
+	empty_tetras_.clear();
+	empty_tetras_.insert(data.begin(), data.end());
+	while (!to_check_.empty())
+		to_check_.pop();
+	point_tetra_.assign(points_.size(), 0);
+	for (std::size_t i = 0; i < tetras_.size(); ++i)
+		if (empty_tetras_.find(i) == empty_tetras_.end())
+			SetPointTetra(i);
+}
+
 std::size_t Delaunay3D::FindThirdNeighbor(std::size_t tetra0,std::size_t tetra1)
 {
 	b4s_temp_ = tetras_[tetra0].neighbors;
@@ -453,190 +560,314 @@ std::size_t Delaunay3D::FindThirdNeighbor(std::size_t tetra0,std::size_t tetra1)
 	return N;
 }
 
-void Delaunay3D::ExactFlip(std::size_t tetra0, std::size_t tetra1, std::size_t p)
+void Delaunay3D::FindFlip(std::size_t tetra0, std::size_t tetra1, std::size_t p)
 {
-	std::size_t out_counter = 0;
-	std::size_t other_point = 0;
-	std::size_t in_counter = 0;
-	std::size_t flat_counter = 0;
-	boost::array<std::size_t, 3> out_check;
 	Tetrahedron const& T0 = tetras_[tetra0];
 	Tetrahedron const& T1 = tetras_[tetra1];
-	std::size_t p_loc = GetPointLocationInTetra(T0, p);
+	std::size_t const p_loc = GetPointLocationInTetra(T0, p);
+	Vector3D const& P = points_[p];
+	Vector3D const& other = points_[T1.points[GetOppositePoint(T1, tetra0)]];
+	boost::array<Vector3D const*, 3> face;
 	for (std::size_t i = 0; i < 3; ++i)
-		b3_temp_[i] = points_[T0.points[(p_loc + 1 + i) % 4]];
+		face[i] = &points_[T0.points[(p_loc + 1 + i) % 4]];
 
-	for (std::size_t i = 0; i < 4; ++i)
+	// The side of the shared face that p is on, it is also the side of the third point of the face relative to the
+	// plane through p and each of the edges of the face
+	double const side = -orient3d(*face[0], *face[1], *face[2], P);
+	if (side > 0 || side < 0)
 	{
-		if (T1.neighbors[i] == tetra0)
+		// Does the segment between p and the other point cross the shared face? out_check[i] is set if it passes
+		// outside of (or on) the edge opposite to face[i]
+		std::size_t out_counter = 0;
+		bool flat = false;
+		boost::array<bool, 3> out_check;
+		for (std::size_t i = 0; i < 3; ++i)
 		{
-			other_point = T1.points[i];
-			break;
+			double const test = orient3d(*face[(i + 1) % 3], *face[(i + 2) % 3], P, other);
+			out_check[i] = !(test * side > 0);
+			if (out_check[i])
+			{
+				++out_counter;
+				if (!(test > 0 || test < 0))
+					flat = true;
+			}
 		}
-	}
 
-	b4_temp_[0] = b3_temp_[1];
-	b4_temp_[1] = b3_temp_[2];
-	b4_temp_[2] = points_[p];
-	b4_temp_[3] = b3_temp_[0];
-	double test0 = orient3d(b4_temp_);
-	if (std::abs(test0) == 0)
-		in_counter++;
-	b4_temp_[3] = points_[other_point];
-	double test1 = orient3d(b4_temp_);
-	if (std::abs(test1) == 0)
-		flat_counter++;
-	if (test0*test1 > 0)
-		out_check[0] = 0;
-	else
-	{
-		out_check[0] = 1;
-		++out_counter;
-	}	
-
-	b4_temp_[0] = b3_temp_[2];
-	b4_temp_[1] = b3_temp_[0];
-	b4_temp_[2] = points_[p];
-	b4_temp_[3] = b3_temp_[1];
-	test0 = orient3d(b4_temp_);
-	if (std::abs(test0) == 0)
-		in_counter++;
-	b4_temp_[3] = points_[other_point];
-	test1 = orient3d(b4_temp_);
-	if (std::abs(test1) == 0)
-		flat_counter++;
-	if (test0*test1 > 0)
-		out_check[1] = 0;
-	else
-	{
-		out_check[1] = 1;
-		++out_counter;
-	}
-
-	b4_temp_[0] = b3_temp_[0];
-	b4_temp_[1] = b3_temp_[1];
-	b4_temp_[2] = points_[p];
-	b4_temp_[3] = b3_temp_[2];
-	test0 = orient3d(b4_temp_);
-	if (std::abs(test0) == 0)
-		in_counter++;
-	b4_temp_[3] = points_[other_point];
-	test1 = orient3d(b4_temp_);
-	if (std::abs(test1) == 0)
-		flat_counter++;
-	if (test0*test1 > 0)
-		out_check[2] = 0;
-	else
-	{
-		out_check[2] = 1;
-		++out_counter;
-	}
-		
-	if (out_counter == 0)
-		flip23(tetra0, tetra1, p_loc);
-	else
-	{
+		if (out_counter == 0)
+		{
+			flip23(tetra0, tetra1, p_loc);
+			return;
+		}
 		if (out_counter == 1)
 		{
-			std::size_t N_shared = FindThirdNeighbor(tetra0, tetra1);
-			if (N_shared == 1)
+			if (FindThirdNeighbor(tetra0, tetra1) == 1)
 			{
-				std::size_t shared_loc = GetOppositePoint(tetras_[tetra0], b8s_temp_[0]);
+				std::size_t shared_loc = GetOppositePoint(T0, b8s_temp_[0]);
 				flip32(tetra0, tetra1, p_loc, shared_loc);
 				return;
 			}
-			else
+			// The points are coplanar with the edge, flip if the edge is shared by four tetras
+			if (flat)
 			{
-				if (flat_counter > 0)
+				for (std::size_t i = 0; i < 3; ++i)
 				{
-					for (std::size_t i = 0; i < 3; ++i)
+					std::size_t N3, N4;
+					if (out_check[i] && Are44(T0, T1, (p_loc + i + 1) % 4, tetras_, N3, N4))
 					{
-						std::size_t N3, N4;
-						if (out_check[i] == 1 && Are44(T0, T1, (p_loc + i + 1) % 4, tetras_, N3, N4))
-						{
-							flip44(tetra0, tetra1, p_loc, N3, N4);
-							return;
-						}
+						flip44(tetra0, tetra1, p_loc, N3, N4);
+						return;
 					}
 				}
 			}
 		}
+		// Otherwise the configuration can not be flipped, it is fixed by flipping one of its neighbors
+	}
+}
+
+void Delaunay3D::InsertPoint(std::size_t index)
+{
+	std::size_t to_split = Walk(index, last_checked_);
+	last_checked_ = to_split;
+	if (on_face_)
+		SplitDegenerate(index, to_split);
+	else
+		flip14(index, to_split);
+	while (!to_check_.empty())
+	{
+		std::size_t cur_check = to_check_.top();
+		to_check_.pop();
+		std::size_t to_flip = tetras_[cur_check].neighbors[GetPointLocationInTetra(tetras_[cur_check], index)];
+		if (to_flip == outside_neighbor_ || (empty_tetras_.find(cur_check) != empty_tetras_.end()))
+			continue;
+		Tetrahedron const& tetra = tetras_[cur_check];
+		std::size_t const other = tetras_[to_flip].points[GetOppositePoint(tetras_[to_flip], cur_check)];
+		boost::array<std::size_t, 5> const indeces = { { tetra.points[0], tetra.points[1], tetra.points[2],
+			tetra.points[3], other } };
+		// The perturbed test never returns zero, so cospherical points are resolved consistently
+		if (insphere(points_[tetra.points[0]], points_[tetra.points[1]], points_[tetra.points[2]],
+			points_[tetra.points[3]], points_[other], indeces, &insphere_tier_counts_) < 0)
+		{
+			FindFlip(cur_check, to_flip,index);
+		}
+	}
+}
+
+void Delaunay3D::SplitDegenerate(std::size_t point, std::size_t tetra)
+{
+	// Find all of the tetras that have the point on one of their faces or edges
+	vector<std::size_t> to_split(1, tetra);
+	for (std::size_t k = 0; k < to_split.size(); ++k)
+	{
+		Tetrahedron const& tet = tetras_[to_split[k]];
+		for (std::size_t i = 0; i < 4; ++i)
+		{
+			if (tet.neighbors[i] == outside_neighbor_ || std::find(to_split.begin(), to_split.end(), tet.neighbors[i])
+				!= to_split.end())
+				continue;
+			for (std::size_t j = 0; j < 3; ++j)
+				b4_temp_[j] = points_[tet.points[(i + j + 1) % 4]];
+			b4_temp_[3] = points_[point];
+			if (orient3d(b4_temp_) == 0)
+				to_split.push_back(tet.neighbors[i]);
+		}
+	}
+	assert(to_split.size() > 1);
+
+	// Every face that is not shared by two of the split tetras is connected to the point
+	vector<Tetrahedron> newtets;
+	vector<std::size_t> outer_loc;
+	for (std::size_t k = 0; k < to_split.size(); ++k)
+	{
+		Tetrahedron const& tet = tetras_[to_split[k]];
+		for (std::size_t i = 0; i < 4; ++i)
+		{
+			if (std::find(to_split.begin(), to_split.end(), tet.neighbors[i]) != to_split.end())
+				continue;
+			// Replacing the opposite point keeps the orientation since the point is on its side of the face
+			Tetrahedron newtet(tet);
+			newtet.points[i] = point;
+			newtets.push_back(newtet);
+			outer_loc.push_back(tet.neighbors[i] == outside_neighbor_ ? 0 :
+				GetOppositePoint(tetras_[tet.neighbors[i]], to_split[k]));
+		}
+	}
+
+	std::size_t const Nnew = newtets.size();
+	vector<std::size_t> Nloc(to_split);
+	std::size_t Nadded = 0;
+	while (Nloc.size() < Nnew)
+	{
+		if (empty_tetras_.empty())
+			Nloc.push_back(tetras_.size() + Nadded++);
 		else
 		{
-			if (in_counter == 3) // tetra0 is flat
+			Nloc.push_back(*empty_tetras_.begin());
+			empty_tetras_.erase(empty_tetras_.begin());
+		}
+	}
+
+	// The new tetras share the faces that contain the point, match them by the edge opposite to the point
+	for (std::size_t k = 0; k < Nnew; ++k)
+	{
+		std::size_t const p_loc = GetPointLocationInTetra(newtets[k], point);
+		std::size_t const outer = newtets[k].neighbors[p_loc];
+		if (outer != outside_neighbor_)
+			tetras_[outer].neighbors[outer_loc[k]] = Nloc[k];
+		for (std::size_t i = 0; i < 4; ++i)
+		{
+			if (i == p_loc)
+				continue;
+			boost::array<std::size_t, 2> edge;
+			std::size_t counter = 0;
+			for (std::size_t l = 0; l < 4; ++l)
+				if (l != i && l != p_loc)
+					edge[counter++] = newtets[k].points[l];
+			for (std::size_t j = 0; j < Nnew; ++j)
 			{
-				//is a 32 flip possible?
-				std::size_t N_shared = FindThirdNeighbor(tetra0, tetra1);
-				if (N_shared == 1)
+				if (j != k && std::find(newtets[j].points.begin(), newtets[j].points.end(), edge[0]) != newtets[j].points.end()
+					&& std::find(newtets[j].points.begin(), newtets[j].points.end(), edge[1]) != newtets[j].points.end())
 				{
-					std::size_t shared_loc = GetOppositePoint(tetras_[tetra0], b8s_temp_[0]);
-					flip32(tetra0, tetra1, p_loc, shared_loc);
-					return;
+					newtets[k].neighbors[i] = Nloc[j];
+					break;
 				}
-				else
-					flip23(tetra0, tetra1, p_loc);
 			}
 		}
 	}
-}
 
-void Delaunay3D::FindFlip(std::size_t tetra0,std::size_t tetra1,std::size_t p)
-{
-	std::size_t p_loc = GetPointLocationInTetra(tetras_[tetra0], p);
-	std::size_t other_point_loc = GetOppositePoint(tetras_[tetra1], tetra0);
-	for (std::size_t i = 0; i < 3;++i)
-		b3_temp_[i] = points_[tetras_[tetra0].points[(p_loc + i + 1) % 4]];
-	Vector3D intersection = PlaneLineIntersection(b3_temp_, points_[p], 
-		points_[tetras_[tetra1].points[other_point_loc]]);
-	std::pair<std::size_t, double> outside_intersection = InTriangle(b3_temp_, intersection);
-	
-	if (outside_intersection.second<1e-6)
+	for (std::size_t k = 0; k < Nnew; ++k)
 	{
-		ExactFlip(tetra0, tetra1, p);
-		return;
+		if (Nloc[k] < tetras_.size())
+			tetras_[Nloc[k]] = newtets[k];
+		else
+			tetras_.push_back(newtets[k]);
+		SetPointTetra(Nloc[k]);
+		to_check_.push(Nloc[k]);
 	}
-	if (outside_intersection.first == 0)
+	last_checked_ = Nloc[0];
+}
+
+std::size_t Delaunay3D::FindOuterTetra(void)
+{
+	// Start from a tetra that contains a point of the large tetra
+	std::size_t const big_point = Norg_;
+	std::size_t const first = point_tetra_[big_point];
+	// Look for a tetra that also has an original point among the tetras around the large tetra point
+	if (tetra_stamp_.size() < tetras_.size())
+		tetra_stamp_.resize(tetras_.size(), 0);
+	++tetra_epoch_;
+	stack<std::size_t> to_check;
+	to_check.push(first);
+	tetra_stamp_[first] = tetra_epoch_;
+	while (!to_check.empty())
 	{
-		flip23(tetra0, tetra1, p_loc);
-		return;
+		std::size_t const cur = to_check.top();
+		to_check.pop();
+		Tetrahedron const& tetra = tetras_[cur];
+		for (std::size_t i = 0; i < 4; ++i)
+			if (tetra.points[i] < Norg_)
+				return cur;
+		for (std::size_t i = 0; i < 4; ++i)
+		{
+			std::size_t const neigh = tetra.neighbors[i];
+			if (tetra.points[i] != big_point && neigh != outside_neighbor_ && tetra_stamp_[neigh] != tetra_epoch_)
+			{
+				tetra_stamp_[neigh] = tetra_epoch_;
+				to_check.push(neigh);
+			}
+		}
 	}
-	if (outside_intersection.first == 1)
+	return first;
+}
+
+void Delaunay3D::GetPointTetras(std::size_t point, vector<std::size_t> &tetras)const
+{
+	// Every tetra around the point is reached through the faces that contain the point
+	if (tetra_stamp_.size() < tetras_.size())
+		tetra_stamp_.resize(tetras_.size(), 0);
+	++tetra_epoch_;
+	tetras.clear();
+	tetras.push_back(point_tetra_[point]);
+	tetra_stamp_[point_tetra_[point]] = tetra_epoch_;
+	for (std::size_t i = 0; i < tetras.size(); ++i)
 	{
-		// Do we have a shared neighbor?
-		std::size_t Nshared = FindThirdNeighbor(tetra0, tetra1);
-		if (Nshared == 1)
+		Tetrahedron const& tetra = tetras_[tetras[i]];
+		for (std::size_t j = 0; j < 4; ++j)
 		{
-			std::size_t shared_loc = GetOppositePoint(tetras_[tetra0], b8s_temp_[0]);
-			flip32(tetra0, tetra1, p_loc, shared_loc);
+			std::size_t const neigh = tetra.neighbors[j];
+			if (tetra.points[j] != point && neigh != outside_neighbor_ && tetra_stamp_[neigh] != tetra_epoch_)
+			{
+				tetra_stamp_[neigh] = tetra_epoch_;
+				tetras.push_back(neigh);
+			}
 		}
-	}	
+	}
 }
 
-void Delaunay3D::InsertPoint(std::size_t index)
+void Delaunay3D::GetPointTetrasThreadSafe(std::size_t point, vector<std::size_t> &tetras)const
 {
-	std::size_t to_split = Walk(index, last_checked_);
-	last_checked_ = to_split;
-	flip14(index, to_split);
-	while (!to_check_.empty())
+	// The same search, with the visited tetras kept in a small sorted set on the stack instead of the shared marks
+	boost::container::flat_set<std::size_t, std::less<std::size_t>, boost::container::small_vector<std::size_t, 64> > visited;
+	tetras.clear();
+	tetras.push_back(point_tetra_[point]);
+	visited.insert(point_tetra_[point]);
+	for (std::size_t i = 0; i < tetras.size(); ++i)
 	{
-		std::size_t cur_check = to_check_.top();
-		to_check_.pop();
-		std::size_t to_flip = tetras_[cur_check].neighbors[GetPointLocationInTetra(tetras_[cur_check], index)];
-		if (to_flip == outside_neighbor_ || (empty_tetras_.find(cur_check) != empty_tetras_.end()))
-			continue;
-		/// check here that we have correct sign for insphere test !!
-		b5_temp_[0] = points_[tetras_[cur_check].points[0]];
-		b5_temp_[1] = points_[tetras_[cur_check].points[1]];
-		b5_temp_[2] = points_[tetras_[cur_check].points[2]];
-		b5_temp_[3] = points_[tetras_[cur_check].points[3]];
-		b5_temp_[4] = points_[tetras_[to_flip].points[GetOppositePoint(tetras_[to_flip], cur_check)]];
-		if (insphere(b5_temp_) <= 0)
+		Tetrahedron const& tetra = tetras_[tetras[i]];
+		for (std::size_t j = 0; j < 4; ++j)
 		{
-			FindFlip(cur_check, to_flip,index);
+			std::size_t const neigh = tetra.neighbors[j];
+			if (tetra.points[j] != point && neigh != outside_neighbor_ && visited.insert(neigh).second)
+				tetras.push_back(neigh);
 		}
 	}
 }
 
+void Delaunay3D::ReorderPoints(vector<std::size_t> const& order)
+{
+	assert(order.size() == Norg_);
+	vector<std::size_t> new_index(Norg_);
+	for (std::size_t i = 0; i < Norg_; ++i)
+		new_index[order[i]] = i;
+	// The free tetras are renumbered as well, so they still point to valid points
+	for (std::size_t i = 0; i < tetras_.size(); ++i)
+		for (std::size_t j = 0; j < 4; ++j)
+			if (tetras_[i].points[j] < Norg_)
+				tetras_[i].points[j] = new_index[tetras_[i].points[j]];
+	vector<Vector3D> points(Norg_);
+	vector<std::size_t> point_tetra(Norg_);
+	for (std::size_t i = 0; i < Norg_; ++i)
+	{
+		points[i] = points_[order[i]];
+		point_tetra[i] = point_tetra_[order[i]];
+	}
+	std::copy(points.begin(), points.end(), points_.begin());
+	std::copy(point_tetra.begin(), point_tetra.end(), point_tetra_.begin());
+	if (hilbert_rank_.size() == Norg_)
+	{
+		vector<std::size_t> rank(Norg_);
+		for (std::size_t i = 0; i < Norg_; ++i)
+			rank[i] = hilbert_rank_[order[i]];
+		hilbert_rank_ = rank;
+	}
+}
+
+void Delaunay3D::SetPointTetra(std::size_t tetra)
+{
+	Tetrahedron const& T = tetras_[tetra];
+	for (std::size_t i = 0; i < 4; ++i)
+		point_tetra_[T.points[i]] = tetra;
+}
+
+boost::array<std::size_t, 3> Delaunay3D::GetInsphereTierCounts(void) const
+{
+	return insphere_tier_counts_;
+}
+
+void Delaunay3D::ResetInsphereTierCounts(void)
+{
+	insphere_tier_counts_.assign(0);
+}
+
 std::size_t Delaunay3D::Walk(std::size_t point, std::size_t first_guess) 
 {
 	bool good = false;
@@ -647,16 +878,21 @@ std::size_t Delaunay3D::Walk(std::size_t point, std::size_t first_guess)
 	{
 		++counter;
 		good = true;
+		on_face_ = false;
 		for (std::size_t i = 0; i < 4; ++i)
 		{
 			for (std::size_t j = 0; j < 3; ++j)
 				b4_temp_[j] = points_[tetras_[cur_facet].points[(i + j + 1) % 4]];
 			int sign = 2 * static_cast<int>(i % 2) - 1;
-			if ((orient3d(b4_temp_)*sign)>0)
+			double const orient = orient3d(b4_temp_)*sign;
+			if (orient>0)
 			{
 				good = false;
 				cur_facet = tetras_[cur_facet].neighbors[i];
 			}
+			else
+				if (orient == 0)
+					on_face_ = true;
 		}
 		assert(counter < 1e7);
 	}
@@ -733,6 +969,10 @@ void Delaunay3D::flip14(std::size_t point, std::size_t tetra)
 	tetras_[tetra].neighbors[0] = Nloc[0];
 	tetras_[tetra].neighbors[1] = Nloc[1];
 	tetras_[tetra].neighbors[2] = Nloc[2];
+	SetPointTetra(tetra);
+	SetPointTetra(Nloc[0]);
+	SetPointTetra(Nloc[1]);
+	SetPointTetra(Nloc[2]);
 	
 	to_check_.push(tetra);
 	to_check_.push(Nloc[0]);
@@ -789,4 +1029,6 @@ void Delaunay3D::Clean(void)
 	tetras_.clear();
 	points_.clear();
 	empty_tetras_.clear();
+	hilbert_rank_.clear();
+	point_tetra_.clear();
 }
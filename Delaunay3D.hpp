@@ -5,6 +5,7 @@
 #include "Tetrahedron.hpp"
 #include <string>
 #include <vector>
+#include <iostream>
 #include <stack>
 #include <set>
 
@@ -21,6 +22,10 @@ public:
 	std::set<std::size_t> empty_tetras_;
 	std::size_t Norg_;
 	std::size_t outside_neighbor_;
+	// The position of each original point along the Hilbert curve, empty when the triangulation was read from a checkpoint
+	vector<std::size_t> hilbert_rank_;
+	// For every point, one tetra that contains it, kept up to date by the flips
+	vector<std::size_t> point_tetra_;
 
 
 	Delaunay3D();
@@ -31,29 +36,94 @@ public:
 
 	void BuildExtra(vector<Vector3D> const& points);
 
+	/*!
+	\brief Adds points to the triangulation in the given order, without sorting them along the Hilbert curve
+	\param points The points to add
+	\param seeds For every point, a tetra close to it where its walk starts
+	*/
+	void BuildExtra(vector<Vector3D> const& points, vector<std::size_t> const& seeds);
+
 	void output(string const& filename)const;
 
+	/*!
+	\brief Writes the full state of the triangulation, including the neighbors and the free tetras, so that it can be restored without rebuilding
+	\param fh The output stream, opened in binary mode
+	*/
+	void WriteCheckpoint(std::ostream &fh)const;
+
+	/*!
+	\brief Restores a triangulation written by WriteCheckpoint, the triangulation is ready for BuildExtra afterwards
+	\param fh The input stream, opened in binary mode
+	*/
+	void ReadCheckpoint(std::istream &fh);
+
 	bool CheckCorrect(void);
 
+	/*!
+	\brief Finds a tetra on the hull of the points by going around a point of the large tetra, without going over all of the tetras
+	\return A tetra with a point of the large tetra and an original point, if there is one around that point of the large tetra
+	*/
+	std::size_t FindOuterTetra(void);
+
+	/*!
+	\brief Returns the number of insphere tests of this triangulation resolved by the semi static filter, by the permanent error bound and by exact arithmetic
+	\return The counts of the three tiers, since construction or the last reset
+	*/
+	boost::array<std::size_t, 3> GetInsphereTierCounts(void)const;
+
+	//! \brief Sets the insphere tier counts to zero
+	void ResetInsphereTierCounts(void);
+
+	/*!
+	\brief Finds the tetras that contain a point by walking around it from point_tetra_, without going over all of the tetras
+	\details The visited tetras are marked in a member array, so the call is not thread safe
+	\param point The index of the point
+	\param tetras The tetras that contain the point, cleared first
+	*/
+	void GetPointTetras(std::size_t point, vector<std::size_t> &tetras)const;
+
+	/*!
+	\brief Same as GetPointTetras but without the shared marks, so it can be called from several threads
+	\param point The index of the point
+	\param tetras The tetras that contain the point, cleared first
+	*/
+	void GetPointTetrasThreadSafe(std::size_t point, vector<std::size_t> &tetras)const;
+
+	/*!
+	\brief Renumbers the original points, the tetras and the other points keep their indeces
+	\param order The old index of every new original point
+	*/
+	void ReorderPoints(vector<std::size_t> const& order);
+
 	void Clean(void);
 private:
 	void InsertPoint(std::size_t index);
 	std::size_t Walk(std::size_t point, std::size_t first_guess);
 	void flip14(std::size_t point,std::size_t tetra);
+	// Inserts a point that lies on a face or an edge of tetra, every tetra that contains the point is split so no flat tetras are created
+	void SplitDegenerate(std::size_t point, std::size_t tetra);
 	void flip23(std::size_t tetra0, std::size_t tetra1,std::size_t location0);
 	void flip32(std::size_t tetra0, std::size_t tetra1, std::size_t location0, std::size_t shared_loction);
+	// Only insphere is perturbed and orient3d is exact, so coplanar flips still go through flip44 and points on faces through SplitDegenerate
 	void flip44(std::size_t tetra0, std::size_t tetra1, std::size_t location0, std::size_t neigh0, std::size_t neigh1);
 	void FindFlip(std::size_t tetrao, std::size_t tetra1, std::size_t p);
-	void ExactFlip(std::size_t tetra0, std::size_t tetra1, std::size_t p);
 	std::size_t FindThirdNeighbor(std::size_t tetra0, std::size_t tetra1);
+	// Points the points of a tetra that was just written at it
+	void SetPointTetra(std::size_t tetra);
 
-	boost::array<Vector3D, 3> b3_temp_,b3_temp2_;
 	boost::array<Vector3D, 4> b4_temp_;
 	boost::array<Vector3D, 5> b5_temp_;
 	boost::array<std::size_t, 4> b4s_temp_,b4s_temp2_;
 	boost::array<std::size_t, 8> b8s_temp_;
 	stack<std::size_t> to_check_;
 	std::size_t last_checked_;
+	// True if the last walk ended with the point on a face or an edge of the tetra
+	bool on_face_;
+	// Counted per triangulation, so triangulations that are built in parallel do not share them
+	boost::array<std::size_t, 3> insphere_tier_counts_;
+	// Visited marks of the tetras, a tetra is visited in the current search if its stamp equals the epoch
+	mutable vector<std::size_t> tetra_stamp_;
+	mutable std::size_t tetra_epoch_;
 };
 
 #endif //DELAUNAY3D_HPP
\ No newline at end of file
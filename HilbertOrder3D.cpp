@@ -500,4 +500,23 @@ vector<std::size_t> HilbertOrder3D(vector<Vector3D> const& cor)
 		// Return the sorting indices:
 		return vIndSort;
 	}
-}
\ No newline at end of file
+}
+
+vector<unsigned long long int> HilbertKeys3D(vector<Vector3D> const& cor, Vector3D const& ll, Vector3D const& ur,
+	int numOfIterations)
+{
+	HilbertCurve3D oHilbert;
+	size_t N = cor.size();
+	vector<unsigned long long int> vOut(N);
+	Vector3D vDiff = ur - ll;
+	Vector3D vAdjusted;
+	for (size_t ii = 0; ii < N; ++ii)
+	{
+		// Scale to the unit cube, points outside the box are moved to its boundary:
+		vAdjusted.x = std::max(0.0, std::min(1.0, (cor[ii].x - ll.x) / vDiff.x));
+		vAdjusted.y = std::max(0.0, std::min(1.0, (cor[ii].y - ll.y) / vDiff.y));
+		vAdjusted.z = std::max(0.0, std::min(1.0, (cor[ii].z - ll.z) / vDiff.z));
+		vOut[ii] = oHilbert.Hilbert3D_xyz2d(vAdjusted, numOfIterations);
+	}
+	return vOut;
+}
@@ -18,4 +18,15 @@ using std::vector;
 */
 vector<std::size_t> HilbertOrder3D(vector<Vector3D> const& cor);
 
+/*!
+\brief Returns the 3D-Hilbert curve distances of points inside a fixed box, so that distances of different point sets can be compared
+\param cor The points
+\param ll The lower left corner of the box
+\param ur The upper right corner of the box
+\param numOfIterations The depth of the curve, at most 21
+\return The Hilbert distances
+*/
+vector<unsigned long long int> HilbertKeys3D(vector<Vector3D> const& cor, Vector3D const& ll, Vector3D const& ur,
+	int numOfIterations);
+
 #endif // HILBERTORDER_HPP
\ No newline at end of file
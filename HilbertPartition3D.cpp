@@ -0,0 +1,85 @@
+#include "HilbertPartition3D.hpp"
+
+#ifdef RICH_MPI
+#include <mpi.h>
+#include <algorithm>
+
+HilbertPartition3D::HilbertPartition3D(Vector3D const& ll, Vector3D const& ur, int numOfIterations) :
+	ll_(ll), ur_(ur), iterations_(std::max(1, std::min(21, numOfIterations))), splitters_()
+{
+	int nproc = 1;
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	unsigned long long int const Nkeys = 1ULL << (3 * iterations_);
+	std::size_t const Nproc = static_cast<std::size_t>(nproc);
+	splitters_.resize(Nproc - 1);
+	for (std::size_t i = 0; i < splitters_.size(); ++i)
+		splitters_[i] = (Nkeys / Nproc) * (i + 1);
+}
+
+void HilbertPartition3D::Update(vector<Vector3D> const& points)
+{
+	int nproc = 1;
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	std::size_t const Nsplit = static_cast<std::size_t>(nproc) - 1;
+	if (Nsplit == 0)
+		return;
+	vector<unsigned long long int> keys = GetKeys(points);
+	std::sort(keys.begin(), keys.end());
+
+	unsigned long long int const local_n = keys.size();
+	unsigned long long int total_n = 0;
+	MPI_Allreduce(&local_n, &total_n, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+	vector<unsigned long long int> target(Nsplit);
+	for (std::size_t i = 0; i < Nsplit; ++i)
+		target[i] = (total_n * (i + 1)) / (Nsplit + 1);
+
+	// Bisect all the splitters at once, the splitter is the smallest key that has enough points below it
+	vector<unsigned long long int> low(Nsplit, 0), high(Nsplit, 1ULL << (3 * iterations_));
+	vector<unsigned long long int> mid(Nsplit), local_count(Nsplit), count(Nsplit);
+	for (int iter = 0; iter <= 3 * iterations_; ++iter)
+	{
+		for (std::size_t i = 0; i < Nsplit; ++i)
+		{
+			mid[i] = low[i] + (high[i] - low[i]) / 2;
+			local_count[i] = static_cast<unsigned long long int>(std::lower_bound(keys.begin(), keys.end(), mid[i]) -
+				keys.begin());
+		}
+		MPI_Allreduce(&local_count[0], &count[0], static_cast<int>(Nsplit), MPI_UNSIGNED_LONG_LONG, MPI_SUM,
+			MPI_COMM_WORLD);
+		for (std::size_t i = 0; i < Nsplit; ++i)
+		{
+			if (count[i] >= target[i])
+				high[i] = mid[i];
+			else
+				low[i] = mid[i] + 1;
+		}
+	}
+	splitters_ = low;
+}
+
+vector<int> HilbertPartition3D::GetOwners(vector<Vector3D> const& points) const
+{
+	vector<unsigned long long int> keys = GetKeys(points);
+	std::size_t const N = keys.size();
+	vector<int> res(N);
+	for (std::size_t i = 0; i < N; ++i)
+		res[i] = static_cast<int>(std::upper_bound(splitters_.begin(), splitters_.end(), keys[i]) - splitters_.begin());
+	return res;
+}
+
+vector<unsigned long long int> HilbertPartition3D::GetKeys(vector<Vector3D> const& points) const
+{
+	return HilbertKeys3D(points, ll_, ur_, iterations_);
+}
+
+vector<unsigned long long int> const& HilbertPartition3D::GetSplitters(void) const
+{
+	return splitters_;
+}
+
+std::pair<Vector3D, Vector3D> HilbertPartition3D::GetBoxCoordinates(void) const
+{
+	return std::pair<Vector3D, Vector3D>(ll_, ur_);
+}
+
+#endif //RICH_MPI
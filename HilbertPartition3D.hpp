@@ -0,0 +1,60 @@
+/*! \file HilbertPartition3D.hpp
+\brief Domain decomposition by contiguous ranges of the 3D Hilbert curve
+\author Elad Steinberg
+*/
+
+#ifndef HILBERT_PARTITION3D_HPP
+#define HILBERT_PARTITION3D_HPP 1
+
+#include "HilbertOrder3D.hpp"
+
+#ifdef RICH_MPI
+
+/*! \brief Splits the domain between the processors by ranges of the Hilbert curve distance
+\details Every processor owns a contiguous range of Hilbert distances, the ranges are chosen so that all the processors have the same number of points. The owner of a point is found by a binary search on the splitters.
+*/
+class HilbertPartition3D
+{
+public:
+	/*! \brief Class constructor, the key space is split evenly until the first update
+	\param ll The lower left corner of the domain
+	\param ur The upper right corner of the domain
+	\param numOfIterations The depth of the Hilbert curve, at most 21
+	*/
+	HilbertPartition3D(Vector3D const& ll, Vector3D const& ur, int numOfIterations = 21);
+
+	/*! \brief Recalculates the splitters so that every processor owns the same number of points, this is a collective call
+	\param points The points of this processor
+	*/
+	void Update(vector<Vector3D> const& points);
+
+	/*! \brief Returns the processors that own the points
+	\param points The points
+	\return The rank of the owner of each point
+	*/
+	vector<int> GetOwners(vector<Vector3D> const& points) const;
+
+	/*! \brief Returns the Hilbert distances of the points
+	\param points The points
+	\return The Hilbert distances
+	*/
+	vector<unsigned long long int> GetKeys(vector<Vector3D> const& points) const;
+
+	/*! \brief Returns the splitters, processor i owns the distances in [splitters[i-1],splitters[i])
+	\return The splitters
+	*/
+	vector<unsigned long long int> const& GetSplitters(void) const;
+
+	/*! \brief Returns the corners of the domain
+	\return The lower left and upper right corners
+	*/
+	std::pair<Vector3D, Vector3D> GetBoxCoordinates(void) const;
+
+private:
+	Vector3D ll_, ur_;
+	int iterations_;
+	vector<unsigned long long int> splitters_;
+};
+
+#endif //RICH_MPI
+#endif //HILBERT_PARTITION3D_HPP
@@ -0,0 +1,73 @@
+#include "MappedFile.hpp"
+#include "universal_error.hpp"
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(std::string const& filename) : data_(0), size_(0), buffer_()
+{
+	std::ifstream fh(filename.c_str(), std::ios::binary | std::ios::ate);
+	if (!fh.good())
+		throw UniversalError("Can't open file " + filename);
+	size_ = static_cast<std::size_t>(fh.tellg());
+	fh.seekg(0, std::ios::beg);
+	buffer_.resize(size_);
+	if (size_ > 0)
+	{
+		fh.read(&buffer_[0], static_cast<std::streamsize>(size_));
+		if (!fh.good())
+			throw UniversalError("Can't read file " + filename);
+		data_ = &buffer_[0];
+	}
+}
+
+MappedFile::~MappedFile(void)
+{}
+#else
+MappedFile::MappedFile(std::string const& filename) : data_(0), size_(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw UniversalError("Can't open file " + filename);
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		throw UniversalError("Can't stat file " + filename);
+	}
+	size_ = static_cast<std::size_t>(st.st_size);
+	if (size_ > 0)
+	{
+		void *map = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+		{
+			close(fd);
+			throw UniversalError("Can't map file " + filename);
+		}
+		data_ = static_cast<char const*>(map);
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile(void)
+{
+	if (data_ != 0)
+		munmap(const_cast<char*>(data_), size_);
+}
+#endif
+
+char const* MappedFile::GetData(void) const
+{
+	return data_;
+}
+
+std::size_t MappedFile::GetSize(void) const
+{
+	return size_;
+}
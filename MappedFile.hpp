@@ -0,0 +1,48 @@
+/*! \file MappedFile.hpp
+\brief Read only view of a whole file, memory mapped where the platform allows it
+\author Elad Steinberg
+*/
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP 1
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*! \brief Read only view of a whole file
+\details On POSIX systems the file is memory mapped so pages are only read when they are touched, on windows the file is read into memory with a single read.
+*/
+class MappedFile
+{
+public:
+	/*! \brief Class constructor, opens and maps the file
+	\param filename The name of the file
+	*/
+	explicit MappedFile(std::string const& filename);
+
+	//! \brief Class destructor, unmaps the file
+	~MappedFile(void);
+
+	/*! \brief Returns the contents of the file
+	\return Pointer to the first byte of the file
+	*/
+	char const* GetData(void) const;
+
+	/*! \brief Returns the size of the file
+	\return The size in bytes
+	*/
+	std::size_t GetSize(void) const;
+
+private:
+	MappedFile(MappedFile const& other);
+	MappedFile& operator=(MappedFile const& other);
+
+	char const* data_;
+	std::size_t size_;
+#ifdef _WIN32
+	std::vector<char> buffer_;
+#endif
+};
+
+#endif //MAPPED_FILE_HPP
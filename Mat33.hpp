@@ -6,6 +6,33 @@
 #ifndef MAT3_HPP
 #define MAT3_HPP 1
 
+#include <math.h>
+
+// \brief Returns a*b+c, with a single rounding when the hardware has a fast fused multiply add
+inline double MulAdd(double a, double b, double c)
+{
+#ifdef FP_FAST_FMA
+	return fma(a, b, c);
+#else
+	return a * b + c;
+#endif
+}
+
+// \brief Returns the determinant of the 2x2 matrix ((a, b), (c, d))
+inline double Det22(double a, double b, double c, double d)
+{
+	return MulAdd(a, d, -b * c);
+}
+
+// \brief Returns the determinant of a 3x3 matrix given by rows, expanded along the first row
+inline double Det33(double d00, double d01, double d02,
+	double d10, double d11, double d12,
+	double d20, double d21, double d22)
+{
+	return MulAdd(d00, Det22(d11, d12, d21, d22), MulAdd(d01, Det22(d12, d10, d22, d20), d02 * Det22(d10, d11, d20,
+		d21)));
+}
+
 template <typename T>
 class Mat33
 {
@@ -50,6 +77,14 @@ inline T Mat33<T>::determinant() const
 		- at(0, 2)*at(1, 1)*at(2, 0) - at(0, 1)*at(1, 0)*at(2, 2) - at(0, 0)*at(1, 2)*at(2, 1);
 }
 
+// \brief The double determinant shares the 2x2 minors and uses fused multiply adds
+template <>
+inline double Mat33<double>::determinant() const
+{
+	return Det33(_data[0][0], _data[0][1], _data[0][2], _data[1][0], _data[1][1], _data[1][2], _data[2][0], _data[2][1],
+		_data[2][2]);
+}
+
 template <typename T>
 inline Mat33<T>::Mat33(T d00, T d01, T d02, 
 	T d10, T d11, T d12, 
@@ -0,0 +1,512 @@
+#include "MeshFile3D.hpp"
+#include "universal_error.hpp"
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#ifdef RICH_MPI
+#include <mpi.h>
+#include "mpi_commands.hpp"
+#endif
+
+namespace
+{
+	boost::uint64_t const endian_marker = 0x0102030405060708ULL;
+	char const mesh_magic[8] = { 'R', 'I', 'C', 'H', '3', 'D', 'M', 0 };
+
+	boost::uint64_t PadTo64(boost::uint64_t size)
+	{
+		return (size + 63) & ~static_cast<boost::uint64_t>(63);
+	}
+
+	template<class T>
+	void WriteSection(std::ofstream &fh, vector<T> const& data, boost::uint64_t offset)
+	{
+		static char const zeros[64] = { 0 };
+		boost::uint64_t const cur = static_cast<boost::uint64_t>(fh.tellp());
+		if (offset > cur)
+			fh.write(zeros, static_cast<std::streamsize>(offset - cur));
+		if (!data.empty())
+			fh.write(reinterpret_cast<char const*>(&data[0]), static_cast<std::streamsize>(data.size() * sizeof(T)));
+	}
+
+	void InitHeader(MeshFile3DHeader &header, boost::uint64_t Ncells, boost::uint64_t Nvertices,
+		boost::uint64_t Nfaces, boost::uint64_t Ncell_faces, boost::uint64_t Nface_points)
+	{
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, mesh_magic, sizeof(mesh_magic));
+		header.version = MESHFILE3D_VERSION;
+		header.endianness = endian_marker;
+		header.Ncells = Ncells;
+		header.Nvertices = Nvertices;
+		header.Nfaces = Nfaces;
+		header.Ncell_faces = Ncell_faces;
+		header.Nface_points = Nface_points;
+		header.points_offset = PadTo64(sizeof(MeshFile3DHeader));
+		header.vertices_offset = PadTo64(header.points_offset + 3 * Ncells * sizeof(double));
+		header.cell_offsets_offset = PadTo64(header.vertices_offset + 3 * Nvertices * sizeof(double));
+		header.cell_faces_offset = PadTo64(header.cell_offsets_offset + (Ncells + 1) * sizeof(boost::uint64_t));
+		header.face_offsets_offset = PadTo64(header.cell_faces_offset + Ncell_faces * sizeof(boost::uint64_t));
+		header.face_points_offset = PadTo64(header.face_offsets_offset + (Nfaces + 1) * sizeof(boost::uint64_t));
+		header.face_neighbors_offset = PadTo64(header.face_points_offset + Nface_points * sizeof(boost::uint64_t));
+		header.file_size = header.face_neighbors_offset + 2 * Nfaces * sizeof(boost::uint64_t);
+	}
+
+	void CheckSection(MeshFile3DHeader const& header, boost::uint64_t offset, boost::uint64_t size,
+		std::string const& name)
+	{
+		if (offset % 64 != 0 || offset < sizeof(MeshFile3DHeader) || offset > header.file_size ||
+			size > header.file_size - offset)
+		{
+			UniversalError eo("Bad section in mesh file");
+			eo.AddEntry(name + " offset", static_cast<double>(offset));
+			eo.AddEntry(name + " size", static_cast<double>(size));
+			eo.AddEntry("File size", static_cast<double>(header.file_size));
+			throw eo;
+		}
+	}
+}
+
+void WriteMeshFile3D(Tessellation3D const& tess, std::string const& filename)
+{
+	std::size_t const Ncells = tess.GetPointNo();
+	std::size_t const Nfaces = tess.GetTotalFacesNumber();
+	vector<Vector3D> const& face_points = tess.GetFacePoints();
+
+	vector<double> points(3 * Ncells);
+	for (std::size_t i = 0; i < Ncells; ++i)
+	{
+		Vector3D const point = tess.GetMeshPoint(i);
+		points[3 * i] = point.x;
+		points[3 * i + 1] = point.y;
+		points[3 * i + 2] = point.z;
+	}
+	vector<double> vertices(3 * face_points.size());
+	for (std::size_t i = 0; i < face_points.size(); ++i)
+	{
+		vertices[3 * i] = face_points[i].x;
+		vertices[3 * i + 1] = face_points[i].y;
+		vertices[3 * i + 2] = face_points[i].z;
+	}
+	vector<boost::uint64_t> cell_offsets(Ncells + 1, 0);
+	for (std::size_t i = 0; i < Ncells; ++i)
+		cell_offsets[i + 1] = cell_offsets[i] + tess.GetCellFaces(i).size();
+	vector<boost::uint64_t> cell_faces(static_cast<std::size_t>(cell_offsets.back()));
+	for (std::size_t i = 0; i < Ncells; ++i)
+	{
+		vector<std::size_t> const& faces = tess.GetCellFaces(i);
+		std::copy(faces.begin(), faces.end(), cell_faces.begin() + static_cast<std::ptrdiff_t>(cell_offsets[i]));
+	}
+	vector<boost::uint64_t> face_offsets(Nfaces + 1, 0);
+	vector<boost::uint64_t> face_neighbors(2 * Nfaces);
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		face_offsets[i + 1] = face_offsets[i] + tess.GetPointsInFace(i).size();
+		std::pair<std::size_t, std::size_t> const neigh = tess.GetFaceNeighbors(i);
+		face_neighbors[2 * i] = neigh.first;
+		face_neighbors[2 * i + 1] = neigh.second;
+	}
+	vector<boost::uint64_t> face_vertices(static_cast<std::size_t>(face_offsets.back()));
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		vector<std::size_t> const& findex = tess.GetPointsInFace(i);
+		std::copy(findex.begin(), findex.end(), face_vertices.begin() + static_cast<std::ptrdiff_t>(face_offsets[i]));
+	}
+
+	MeshFile3DHeader header;
+	InitHeader(header, Ncells, face_points.size(), Nfaces, cell_faces.size(), face_vertices.size());
+
+	std::ofstream fh(filename.c_str(), std::ios::binary);
+	if (!fh.good())
+		throw UniversalError("Can't open file " + filename);
+	fh.write(reinterpret_cast<char const*>(&header), sizeof(header));
+	WriteSection(fh, points, header.points_offset);
+	WriteSection(fh, vertices, header.vertices_offset);
+	WriteSection(fh, cell_offsets, header.cell_offsets_offset);
+	WriteSection(fh, cell_faces, header.cell_faces_offset);
+	WriteSection(fh, face_offsets, header.face_offsets_offset);
+	WriteSection(fh, face_vertices, header.face_points_offset);
+	WriteSection(fh, face_neighbors, header.face_neighbors_offset);
+	if (!fh.good())
+		throw UniversalError("Failed writing mesh file " + filename);
+	fh.close();
+}
+
+MeshFile3D::MeshFile3D(std::string const& filename) : file_(filename), header_(), points_(0), vertices_(0),
+cell_offsets_(0), cell_faces_(0), face_offsets_(0), face_points_(0), face_neighbors_(0)
+{
+	if (file_.GetSize() < sizeof(MeshFile3DHeader))
+		throw UniversalError("File is too small to be a mesh file " + filename);
+	std::memcpy(&header_, file_.GetData(), sizeof(MeshFile3DHeader));
+	if (std::memcmp(header_.magic, mesh_magic, sizeof(mesh_magic)) != 0)
+		throw UniversalError("Not a mesh file " + filename);
+	if (header_.endianness != endian_marker)
+		throw UniversalError("Mesh file was written with a different byte order " + filename);
+	if (header_.version != MESHFILE3D_VERSION)
+	{
+		UniversalError eo("Unsupported mesh file version");
+		eo.AddEntry("Version", static_cast<double>(header_.version));
+		throw eo;
+	}
+	if (header_.file_size > file_.GetSize())
+		throw UniversalError("Mesh file is truncated " + filename);
+	CheckSection(header_, header_.points_offset, 3 * header_.Ncells * sizeof(double), "Points");
+	CheckSection(header_, header_.vertices_offset, 3 * header_.Nvertices * sizeof(double), "Vertices");
+	CheckSection(header_, header_.cell_offsets_offset, (header_.Ncells + 1) * sizeof(boost::uint64_t), "Cell offsets");
+	CheckSection(header_, header_.cell_faces_offset, header_.Ncell_faces * sizeof(boost::uint64_t), "Cell faces");
+	CheckSection(header_, header_.face_offsets_offset, (header_.Nfaces + 1) * sizeof(boost::uint64_t), "Face offsets");
+	CheckSection(header_, header_.face_points_offset, header_.Nface_points * sizeof(boost::uint64_t), "Face points");
+	CheckSection(header_, header_.face_neighbors_offset, 2 * header_.Nfaces * sizeof(boost::uint64_t),
+		"Face neighbors");
+	char const* data = file_.GetData();
+	points_ = reinterpret_cast<double const*>(data + header_.points_offset);
+	vertices_ = reinterpret_cast<double const*>(data + header_.vertices_offset);
+	cell_offsets_ = reinterpret_cast<boost::uint64_t const*>(data + header_.cell_offsets_offset);
+	cell_faces_ = reinterpret_cast<boost::uint64_t const*>(data + header_.cell_faces_offset);
+	face_offsets_ = reinterpret_cast<boost::uint64_t const*>(data + header_.face_offsets_offset);
+	face_points_ = reinterpret_cast<boost::uint64_t const*>(data + header_.face_points_offset);
+	face_neighbors_ = reinterpret_cast<boost::uint64_t const*>(data + header_.face_neighbors_offset);
+}
+
+MeshFile3DHeader const& MeshFile3D::GetHeader(void) const
+{
+	return header_;
+}
+
+std::size_t MeshFile3D::GetPointNo(void) const
+{
+	return static_cast<std::size_t>(header_.Ncells);
+}
+
+Vector3D MeshFile3D::GetMeshPoint(std::size_t index) const
+{
+	return Vector3D(points_[3 * index], points_[3 * index + 1], points_[3 * index + 2]);
+}
+
+std::size_t MeshFile3D::GetTotalFacesNumber(void) const
+{
+	return static_cast<std::size_t>(header_.Nfaces);
+}
+
+std::size_t MeshFile3D::GetFacePointsNumber(void) const
+{
+	return static_cast<std::size_t>(header_.Nvertices);
+}
+
+Vector3D MeshFile3D::GetFacePoint(std::size_t index) const
+{
+	return Vector3D(vertices_[3 * index], vertices_[3 * index + 1], vertices_[3 * index + 2]);
+}
+
+std::size_t MeshFile3D::GetCellFacesNumber(std::size_t index) const
+{
+	return static_cast<std::size_t>(cell_offsets_[index + 1] - cell_offsets_[index]);
+}
+
+boost::uint64_t const* MeshFile3D::GetCellFaces(std::size_t index) const
+{
+	return cell_faces_ + cell_offsets_[index];
+}
+
+std::size_t MeshFile3D::GetPointsInFaceNumber(std::size_t index) const
+{
+	return static_cast<std::size_t>(face_offsets_[index + 1] - face_offsets_[index]);
+}
+
+boost::uint64_t const* MeshFile3D::GetPointsInFace(std::size_t index) const
+{
+	return face_points_ + face_offsets_[index];
+}
+
+std::pair<std::size_t, std::size_t> MeshFile3D::GetFaceNeighbors(std::size_t index) const
+{
+	return std::pair<std::size_t, std::size_t>(static_cast<std::size_t>(face_neighbors_[2 * index]),
+		static_cast<std::size_t>(face_neighbors_[2 * index + 1]));
+}
+
+#ifdef RICH_MPI
+namespace
+{
+	void ScanCount(boost::uint64_t local, boost::uint64_t &offset, boost::uint64_t &total)
+	{
+		unsigned long long int temp = local, res = 0;
+		MPI_Exscan(&temp, &res, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+		int rank = 0;
+		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+		offset = rank == 0 ? 0 : res;
+		MPI_Allreduce(&temp, &res, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+		total = res;
+	}
+
+	// Collective write, split into chunks so that the count fits in an int
+	template<class T>
+	void WriteSectionAll(MPI_File fh, boost::uint64_t offset, vector<T> const& data)
+	{
+		static char dummy = 0;
+		boost::uint64_t const chunk = 1ULL << 30;
+		boost::uint64_t const bytes = data.size() * sizeof(T);
+		unsigned long long int nchunks = (bytes + chunk - 1) / chunk, maxchunks = 0;
+		MPI_Allreduce(&nchunks, &maxchunks, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+		char const* ptr = data.empty() ? &dummy : reinterpret_cast<char const*>(&data[0]);
+		for (boost::uint64_t i = 0; i < maxchunks; ++i)
+		{
+			boost::uint64_t const start = std::min<boost::uint64_t>(i * chunk, bytes);
+			boost::uint64_t const count = std::min<boost::uint64_t>(chunk, bytes - start);
+			MPI_File_write_at_all(fh, static_cast<MPI_Offset>(offset + start), const_cast<char*>(ptr + start),
+				static_cast<int>(count), MPI_BYTE, MPI_STATUS_IGNORE);
+		}
+	}
+
+	// Sorted pair of global cell indeces used to match the faces of two processors
+	std::pair<double, double> FaceKey(double gid0, double gid1)
+	{
+		return gid0 < gid1 ? std::pair<double, double>(gid0, gid1) : std::pair<double, double>(gid1, gid0);
+	}
+
+	typedef std::pair<std::pair<double, double>, std::size_t> FaceEntry;
+
+	// Returns the local face with the given key or the max size_t if there is none
+	std::size_t FindFace(vector<FaceEntry> const& sorted, std::pair<double, double> const& key)
+	{
+		vector<FaceEntry>::const_iterator it = std::lower_bound(sorted.begin(), sorted.end(), FaceEntry(key, 0));
+		if (it != sorted.end() && it->first == key)
+			return it->second;
+		return std::numeric_limits<std::size_t>::max();
+	}
+}
+
+void WriteMeshFile3DMPI(Tessellation3D const& tess, std::string const& filename)
+{
+	std::size_t const Ncells = tess.GetPointNo();
+	std::size_t const Nfaces = tess.GetTotalFacesNumber();
+	std::size_t const Ntotal = tess.GetTotalPointNumber();
+	vector<int> const procs = tess.GetDuplicatedProcs();
+	vector<vector<std::size_t> > const& duplicated = tess.GetDuplicatedPoints();
+	vector<vector<std::size_t> > const& ghosts = tess.GetGhostIndeces();
+	std::size_t const Nprocs = procs.size();
+
+	boost::uint64_t cell_offset = 0, Ncells_total = 0;
+	ScanCount(Ncells, cell_offset, Ncells_total);
+
+	// Global indeces of the ghosts, mirror points get Ncells_total
+	vector<double> gid(Ntotal, static_cast<double>(Ncells_total));
+	vector<int> ghost_proc(Ntotal, -1);
+	for (std::size_t i = 0; i < Ncells; ++i)
+		gid[i] = static_cast<double>(cell_offset + i);
+	vector<vector<double> > tosend(Nprocs);
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j < duplicated[i].size(); ++j)
+			tosend[i].push_back(gid[duplicated[i][j]]);
+	vector<vector<double> > incoming = MPI_exchange_data(procs, tosend);
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j < incoming[i].size(); ++j)
+		{
+			gid[ghosts[i][j]] = incoming[i][j];
+			ghost_proc[ghosts[i][j]] = static_cast<int>(i);
+		}
+
+	// Decide which of the shared faces this processor writes
+	vector<char> keep(Nfaces, 1);
+	vector<std::size_t> remote_face(Nfaces, Nprocs);
+	vector<vector<double> > queries(Nprocs);
+	vector<vector<std::size_t> > query_faces(Nprocs);
+	vector<FaceEntry> owned;
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		std::pair<std::size_t, std::size_t> const neigh = tess.GetFaceNeighbors(i);
+		std::size_t const local = neigh.first < Ncells ? neigh.first : neigh.second;
+		std::size_t const other = neigh.first < Ncells ? neigh.second : neigh.first;
+		if (other < Ncells || ghost_proc[other] < 0)
+			continue;
+		std::size_t const proc = static_cast<std::size_t>(ghost_proc[other]);
+		if (gid[local] < gid[other])
+		{
+			owned.push_back(FaceEntry(FaceKey(gid[local], gid[other]), i));
+		}
+		else
+		{
+			keep[i] = 0;
+			remote_face[i] = proc;
+			queries[proc].push_back(gid[other]);
+			queries[proc].push_back(gid[local]);
+			query_faces[proc].push_back(i);
+		}
+	}
+	std::sort(owned.begin(), owned.end());
+	vector<vector<double> > incoming_queries = MPI_exchange_data(procs, queries);
+	// Reply which of the queried faces are missing here
+	vector<vector<double> > replies(Nprocs);
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j + 1 < incoming_queries[i].size(); j += 2)
+			replies[i].push_back(FindFace(owned, FaceKey(incoming_queries[i][j], incoming_queries[i][j + 1])) <
+				Nfaces ? 0 : 1);
+	vector<vector<double> > missing = MPI_exchange_data(procs, replies);
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j < missing[i].size(); ++j)
+			if (missing[i][j] > 0.5)
+			{
+				keep[query_faces[i][j]] = 1;
+				remote_face[query_faces[i][j]] = Nprocs;
+			}
+
+	// Number the written faces and vertices
+	vector<double> face_gid(Nfaces, -1);
+	vector<std::size_t> vertex_index(tess.GetFacePoints().size(), std::numeric_limits<std::size_t>::max());
+	vector<double> vertices;
+	std::size_t Nkept = 0, Nface_points = 0, Nvertices = 0;
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		if (!keep[i])
+			continue;
+		++Nkept;
+		vector<std::size_t> const& findex = tess.GetPointsInFace(i);
+		Nface_points += findex.size();
+		for (std::size_t j = 0; j < findex.size(); ++j)
+			if (vertex_index[findex[j]] == std::numeric_limits<std::size_t>::max())
+			{
+				vertex_index[findex[j]] = Nvertices++;
+				Vector3D const& vertex = tess.GetFacePoints()[findex[j]];
+				vertices.push_back(vertex.x);
+				vertices.push_back(vertex.y);
+				vertices.push_back(vertex.z);
+			}
+	}
+	boost::uint64_t face_offset = 0, Nfaces_total = 0, vertex_offset = 0, Nvertices_total = 0;
+	boost::uint64_t face_point_offset = 0, Nface_points_total = 0;
+	ScanCount(Nkept, face_offset, Nfaces_total);
+	ScanCount(Nvertices, vertex_offset, Nvertices_total);
+	ScanCount(Nface_points, face_point_offset, Nface_points_total);
+	std::size_t counter = 0;
+	for (std::size_t i = 0; i < Nfaces; ++i)
+		if (keep[i])
+			face_gid[i] = static_cast<double>(face_offset + counter++);
+
+	// Get the global indeces of the faces that the other processors write
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j + 1 < incoming_queries[i].size(); j += 2)
+		{
+			std::size_t const face = FindFace(owned, FaceKey(incoming_queries[i][j], incoming_queries[i][j + 1]));
+			replies[i][j / 2] = face < Nfaces ? face_gid[face] : -1;
+		}
+	vector<vector<double> > remote_gids = MPI_exchange_data(procs, replies);
+	for (std::size_t i = 0; i < Nprocs; ++i)
+		for (std::size_t j = 0; j < remote_gids[i].size(); ++j)
+			if (remote_face[query_faces[i][j]] < Nprocs)
+				face_gid[query_faces[i][j]] = remote_gids[i][j];
+	for (std::size_t i = 0; i < Nfaces; ++i)
+		if (face_gid[i] < 0)
+		{
+			UniversalError eo("Face without a global index in WriteMeshFile3DMPI");
+			eo.AddEntry("Face", static_cast<double>(i));
+			eo.AddEntry("Neighbor 0", static_cast<double>(tess.GetFaceNeighbors(i).first));
+			eo.AddEntry("Neighbor 1", static_cast<double>(tess.GetFaceNeighbors(i).second));
+			throw eo;
+		}
+
+	// Build the local slices of the sections
+	vector<double> points(3 * Ncells);
+	vector<boost::uint64_t> cell_offsets, cell_faces;
+	boost::uint64_t Ncell_faces = 0;
+	for (std::size_t i = 0; i < Ncells; ++i)
+		Ncell_faces += tess.GetCellFaces(i).size();
+	boost::uint64_t cell_face_offset = 0, Ncell_faces_total = 0;
+	ScanCount(Ncell_faces, cell_face_offset, Ncell_faces_total);
+	cell_offsets.reserve(Ncells + 1);
+	cell_faces.reserve(static_cast<std::size_t>(Ncell_faces));
+	for (std::size_t i = 0; i < Ncells; ++i)
+	{
+		Vector3D const point = tess.GetMeshPoint(i);
+		points[3 * i] = point.x;
+		points[3 * i + 1] = point.y;
+		points[3 * i + 2] = point.z;
+		cell_offsets.push_back(cell_face_offset + cell_faces.size());
+		vector<std::size_t> const& faces = tess.GetCellFaces(i);
+		for (std::size_t j = 0; j < faces.size(); ++j)
+			cell_faces.push_back(static_cast<boost::uint64_t>(face_gid[faces[j]]));
+	}
+	vector<boost::uint64_t> face_offsets, face_vertices, face_neighbors;
+	face_offsets.reserve(Nkept + 1);
+	face_vertices.reserve(Nface_points);
+	face_neighbors.reserve(2 * Nkept);
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		if (!keep[i])
+			continue;
+		face_offsets.push_back(face_point_offset + face_vertices.size());
+		vector<std::size_t> const& findex = tess.GetPointsInFace(i);
+		for (std::size_t j = 0; j < findex.size(); ++j)
+			face_vertices.push_back(vertex_offset + vertex_index[findex[j]]);
+		std::pair<std::size_t, std::size_t> const neigh = tess.GetFaceNeighbors(i);
+		face_neighbors.push_back(static_cast<boost::uint64_t>(gid[neigh.first]));
+		face_neighbors.push_back(static_cast<boost::uint64_t>(gid[neigh.second]));
+	}
+	int rank = 0, nproc = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	if (rank == nproc - 1)
+	{
+		cell_offsets.push_back(Ncell_faces_total);
+		face_offsets.push_back(Nface_points_total);
+	}
+
+	MeshFile3DHeader header;
+	InitHeader(header, Ncells_total, Nvertices_total, Nfaces_total, Ncell_faces_total, Nface_points_total);
+	MPI_File fh;
+	if (MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(filename.c_str()), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+		MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+		throw UniversalError("Can't open file " + filename);
+	MPI_File_set_size(fh, static_cast<MPI_Offset>(header.file_size));
+	if (rank == 0)
+		MPI_File_write_at(fh, 0, &header, static_cast<int>(sizeof(header)), MPI_BYTE, MPI_STATUS_IGNORE);
+	WriteSectionAll(fh, header.points_offset + 3 * cell_offset * sizeof(double), points);
+	WriteSectionAll(fh, header.vertices_offset + 3 * vertex_offset * sizeof(double), vertices);
+	WriteSectionAll(fh, header.cell_offsets_offset + cell_offset * sizeof(boost::uint64_t), cell_offsets);
+	WriteSectionAll(fh, header.cell_faces_offset + cell_face_offset * sizeof(boost::uint64_t), cell_faces);
+	WriteSectionAll(fh, header.face_offsets_offset + face_offset * sizeof(boost::uint64_t), face_offsets);
+	WriteSectionAll(fh, header.face_points_offset + face_point_offset * sizeof(boost::uint64_t), face_vertices);
+	WriteSectionAll(fh, header.face_neighbors_offset + 2 * face_offset * sizeof(boost::uint64_t), face_neighbors);
+	MPI_File_close(&fh);
+}
+
+vector<Vector3D> ReadMeshFile3DPointsMPI(std::string const& filename)
+{
+	int rank = 0, nproc = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	MPI_File fh;
+	if (MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(filename.c_str()), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh)
+		!= MPI_SUCCESS)
+		throw UniversalError("Can't open file " + filename);
+	MeshFile3DHeader header;
+	MPI_File_read_at_all(fh, 0, &header, static_cast<int>(sizeof(header)), MPI_BYTE, MPI_STATUS_IGNORE);
+	if (std::memcmp(header.magic, mesh_magic, sizeof(mesh_magic)) != 0 || header.endianness != endian_marker ||
+		header.version != MESHFILE3D_VERSION)
+	{
+		MPI_File_close(&fh);
+		throw UniversalError("Not a readable mesh file " + filename);
+	}
+	boost::uint64_t const start = (header.Ncells * static_cast<boost::uint64_t>(rank)) / static_cast<boost::uint64_t>(nproc);
+	boost::uint64_t const end = (header.Ncells * static_cast<boost::uint64_t>(rank + 1)) /
+		static_cast<boost::uint64_t>(nproc);
+	vector<double> data(static_cast<std::size_t>(3 * (end - start)));
+	// Read in chunks so that the count fits in an int
+	boost::uint64_t const chunk = 1ULL << 27;
+	unsigned long long int nchunks = (data.size() + chunk - 1) / chunk, maxchunks = 0;
+	MPI_Allreduce(&nchunks, &maxchunks, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+	double dummy = 0;
+	for (boost::uint64_t i = 0; i < maxchunks; ++i)
+	{
+		boost::uint64_t const first = std::min<boost::uint64_t>(i * chunk, static_cast<boost::uint64_t>(data.size()));
+		boost::uint64_t const count = std::min<boost::uint64_t>(chunk, data.size() - first);
+		MPI_File_read_at_all(fh, static_cast<MPI_Offset>(header.points_offset + (3 * start + first) * sizeof(double)),
+			count > 0 ? &data[static_cast<std::size_t>(first)] : &dummy, static_cast<int>(count), MPI_DOUBLE,
+			MPI_STATUS_IGNORE);
+	}
+	MPI_File_close(&fh);
+	vector<Vector3D> res(static_cast<std::size_t>(end - start));
+	for (std::size_t i = 0; i < res.size(); ++i)
+		res[i] = Vector3D(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+	return res;
+}
+#endif //RICH_MPI
@@ -0,0 +1,163 @@
+/*! \file MeshFile3D.hpp
+\brief Binary mesh file with a header and 64 byte aligned sections that can be read through a memory map
+\author Elad Steinberg
+*/
+
+#ifndef MESHFILE3D_HPP
+#define MESHFILE3D_HPP 1
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include "Tessellation3D.hpp"
+#include "MappedFile.hpp"
+
+//! \brief The version of the mesh file format
+#define MESHFILE3D_VERSION 1
+
+/*! \brief The header of a mesh file
+\details All the counts and offsets are in the byte order of the machine that wrote the file, the endianness field is used to detect a mismatch. The offsets are in bytes from the start of the file and are multiples of 64. The cell faces and the points in the faces are stored in CSR form, with Ncells+1 and Nfaces+1 offsets.
+*/
+struct MeshFile3DHeader
+{
+	//! \brief File signature
+	char magic[8];
+	//! \brief Format version
+	boost::uint64_t version;
+	//! \brief The value 0x0102030405060708 as written by the writer
+	boost::uint64_t endianness;
+	//! \brief Number of cells
+	boost::uint64_t Ncells;
+	//! \brief Number of face vertices
+	boost::uint64_t Nvertices;
+	//! \brief Number of faces
+	boost::uint64_t Nfaces;
+	//! \brief Total number of faces in all the cells
+	boost::uint64_t Ncell_faces;
+	//! \brief Total number of vertices in all the faces
+	boost::uint64_t Nface_points;
+	//! \brief Offset of the mesh points, 3 doubles per cell
+	boost::uint64_t points_offset;
+	//! \brief Offset of the face vertices, 3 doubles per vertex
+	boost::uint64_t vertices_offset;
+	//! \brief Offset of the CSR offsets of the cell faces
+	boost::uint64_t cell_offsets_offset;
+	//! \brief Offset of the faces of the cells
+	boost::uint64_t cell_faces_offset;
+	//! \brief Offset of the CSR offsets of the face vertices
+	boost::uint64_t face_offsets_offset;
+	//! \brief Offset of the vertices of the faces
+	boost::uint64_t face_points_offset;
+	//! \brief Offset of the face neighbors, 2 per face, a neighbor not smaller than Ncells is a ghost or a mirror point
+	boost::uint64_t face_neighbors_offset;
+	//! \brief Total size of the file
+	boost::uint64_t file_size;
+};
+
+/*! \brief Writes a tessellation to a mesh file using one write per section
+\param tess The tessellation
+\param filename The name of the file
+*/
+void WriteMeshFile3D(Tessellation3D const& tess, std::string const& filename);
+
+#ifdef RICH_MPI
+/*! \brief Writes the tessellations of all the processors to a single mesh file, this is a collective call
+\details Cells are numbered by rank and then by local index. A face shared by two processors is written once, by the processor that holds the cell with the smaller global index, or by the other one if that processor lacks the face. Face vertices are numbered per processor, so a vertex shared by faces written by different processors appears once for each of them. Neighbors that are mirror points of the outer box get the index Ncells.
+\param tess The local tessellation
+\param filename The name of the file
+*/
+void WriteMeshFile3DMPI(Tessellation3D const& tess, std::string const& filename);
+
+/*! \brief Reads the mesh points of a mesh file for a restart, every processor reads a contiguous and equal share, this is a collective call
+\details Only the points are restored, the tessellation has to be built from them again.
+\param filename The name of the file
+\return The points of this processor
+*/
+vector<Vector3D> ReadMeshFile3DPointsMPI(std::string const& filename);
+#endif
+
+/*! \brief Read only access to a mesh file
+\details The file is memory mapped so opening it costs only the header check, and every cell and face is accessed in constant time.
+*/
+class MeshFile3D
+{
+public:
+	/*! \brief Class constructor, opens the file and checks the header
+	\param filename The name of the file
+	*/
+	explicit MeshFile3D(std::string const& filename);
+
+	/*! \brief Returns the header of the file
+	\return The header
+	*/
+	MeshFile3DHeader const& GetHeader(void) const;
+
+	/*! \brief Returns the number of cells
+	\return The number of cells
+	*/
+	std::size_t GetPointNo(void) const;
+
+	/*! \brief Returns the mesh point of a cell
+	\param index The index of the cell
+	\return The mesh point
+	*/
+	Vector3D GetMeshPoint(std::size_t index) const;
+
+	/*! \brief Returns the number of faces
+	\return The number of faces
+	*/
+	std::size_t GetTotalFacesNumber(void) const;
+
+	/*! \brief Returns the number of face vertices
+	\return The number of face vertices
+	*/
+	std::size_t GetFacePointsNumber(void) const;
+
+	/*! \brief Returns a face vertex
+	\param index The index of the vertex
+	\return The vertex
+	*/
+	Vector3D GetFacePoint(std::size_t index) const;
+
+	/*! \brief Returns the number of faces of a cell
+	\param index The index of the cell
+	\return The number of faces
+	*/
+	std::size_t GetCellFacesNumber(std::size_t index) const;
+
+	/*! \brief Returns the faces of a cell
+	\param index The index of the cell
+	\return Pointer to the first face index of the cell
+	*/
+	boost::uint64_t const* GetCellFaces(std::size_t index) const;
+
+	/*! \brief Returns the number of vertices of a face
+	\param index The index of the face
+	\return The number of vertices
+	*/
+	std::size_t GetPointsInFaceNumber(std::size_t index) const;
+
+	/*! \brief Returns the vertices of a face, ordered in a right hand manner with respect to the first neighbor
+	\param index The index of the face
+	\return Pointer to the first vertex index of the face
+	*/
+	boost::uint64_t const* GetPointsInFace(std::size_t index) const;
+
+	/*! \brief Returns the neighbors of a face
+	\param index The index of the face
+	\return The neighbors
+	*/
+	std::pair<std::size_t, std::size_t> GetFaceNeighbors(std::size_t index) const;
+
+private:
+	MappedFile file_;
+	MeshFile3DHeader header_;
+	double const* points_;
+	double const* vertices_;
+	boost::uint64_t const* cell_offsets_;
+	boost::uint64_t const* cell_faces_;
+	boost::uint64_t const* face_offsets_;
+	boost::uint64_t const* face_points_;
+	boost::uint64_t const* face_neighbors_;
+};
+
+#endif //MESHFILE3D_HPP
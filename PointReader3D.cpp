@@ -0,0 +1,93 @@
+#include "PointReader3D.hpp"
+#include "MappedFile.hpp"
+#include "universal_error.hpp"
+#include <cstring>
+#include <algorithm>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace
+{
+	std::size_t GetPointsNumber(MappedFile const& file, std::string const& filename)
+	{
+		int npoints = 0;
+		if (file.GetSize() < sizeof(int))
+			throw UniversalError("Point file is too small " + filename);
+		std::memcpy(&npoints, file.GetData(), sizeof(int));
+		if (npoints < 0 || file.GetSize() < sizeof(int) + 3 * sizeof(double) * static_cast<std::size_t>(npoints))
+		{
+			UniversalError eo("Point file is truncated " + filename);
+			eo.AddEntry("Number of points", static_cast<double>(npoints));
+			eo.AddEntry("File size", static_cast<double>(file.GetSize()));
+			throw eo;
+		}
+		return static_cast<std::size_t>(npoints);
+	}
+
+	// The conversion is split into chunks of at most this many points, so that many small files and a few large ones both keep the threads busy
+	std::size_t const convert_chunk = 65536;
+
+	struct ConvertChunk
+	{
+		char const* data;
+		std::size_t npoints, offset;
+	};
+
+	void ConvertPoints(ConvertChunk const& chunk, vector<Vector3D> &points)
+	{
+		// The doubles are not aligned since they follow a 4 byte int
+		for (std::size_t i = 0; i < chunk.npoints; ++i)
+		{
+			double temp[3];
+			std::memcpy(temp, chunk.data + 3 * sizeof(double) * i, 3 * sizeof(double));
+			Vector3D &point = points[chunk.offset + i];
+			point.x = temp[0];
+			point.y = temp[1];
+			point.z = temp[2];
+		}
+	}
+}
+
+std::size_t ReadPointsNumber(std::string const& filename)
+{
+	MappedFile file(filename);
+	return GetPointsNumber(file, filename);
+}
+
+vector<Vector3D> ReadPoints3D(std::string const& filename)
+{
+	vector<Vector3D> res;
+	ReadPoints3D(vector<std::string>(1, filename), res);
+	return res;
+}
+
+void ReadPoints3D(vector<std::string> const& filenames, vector<Vector3D> &points)
+{
+	// Every file is mapped once and stays mapped for the conversion
+	std::size_t const Nfiles = filenames.size();
+	boost::ptr_vector<MappedFile> files;
+	files.reserve(Nfiles);
+	vector<ConvertChunk> chunks;
+	std::size_t offset = points.size();
+	for (std::size_t i = 0; i < Nfiles; ++i)
+	{
+		files.push_back(new MappedFile(filenames[i]));
+		std::size_t const npoints = GetPointsNumber(files.back(), filenames[i]);
+		char const* data = files.back().GetData() + sizeof(int);
+		for (std::size_t j = 0; j < npoints; j += convert_chunk)
+		{
+			ConvertChunk chunk;
+			chunk.data = data + 3 * sizeof(double) * j;
+			chunk.npoints = std::min(convert_chunk, npoints - j);
+			chunk.offset = offset + j;
+			chunks.push_back(chunk);
+		}
+		offset += npoints;
+	}
+	points.resize(offset);
+	long const Nchunks = static_cast<long>(chunks.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long i = 0; i < Nchunks; ++i)
+		ConvertPoints(chunks[static_cast<std::size_t>(i)], points);
+}
@@ -0,0 +1,32 @@
+/*! \file PointReader3D.hpp
+\brief Bulk reading of binary point files
+\details A point file holds an int with the number of points followed by the x, y and z of every point as doubles.
+\author Elad Steinberg
+*/
+
+#ifndef POINTREADER3D_HPP
+#define POINTREADER3D_HPP 1
+
+#include <string>
+#include "Vector3D.hpp"
+
+/*! \brief Returns the number of points in a point file
+\param filename The name of the file
+\return The number of points
+*/
+std::size_t ReadPointsNumber(std::string const& filename);
+
+/*! \brief Reads a point file
+\param filename The name of the file
+\return The points
+*/
+vector<Vector3D> ReadPoints3D(std::string const& filename);
+
+/*! \brief Reads several point files and appends them in order, the output is resized once and every file is converted straight into its place
+\details Every file is memory mapped once, and the conversion of all of the files is split into chunks that are shared between OpenMP threads when they are enabled
+\param filenames The names of the files
+\param points The output points, the new points are appended
+*/
+void ReadPoints3D(vector<std::string> const& filenames, vector<Vector3D> &points);
+
+#endif //POINTREADER3D_HPP
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include "Predicates3D.hpp"
+#include <algorithm>
 
 double const epsilon = 1.1102230246251565e-016;
 double const splitter = 134217729;
@@ -3416,125 +3417,24 @@ namespace
 		return insphereexact(pa, pb, pc, pd, pe);
 	}
 
-	double insphere(double *pa, double * pb, double * pc, double * pd, double * pe)
-	{
-		double aex, bex, cex, dex;
-		double aey, bey, cey, dey;
-		double aez, bez, cez, dez;
-		double aexbey, bexaey, bexcey, cexbey, cexdey, dexcey, dexaey, aexdey;
-		double aexcey, cexaey, bexdey, dexbey;
-		double alift, blift, clift, dlift;
-		double ab, bc, cd, da, ac, bd;
-		double abc, bcd, cda, dab;
-		double aezplus, bezplus, cezplus, dezplus;
-		double aexbeyplus, bexaeyplus, bexceyplus, cexbeyplus;
-		double cexdeyplus, dexceyplus, dexaeyplus, aexdeyplus;
-		double aexceyplus, cexaeyplus, bexdeyplus, dexbeyplus;
-		double det;
-		double permanent, errbound;
-
-		aex = pa[0] - pe[0];
-		bex = pb[0] - pe[0];
-		cex = pc[0] - pe[0];
-		dex = pd[0] - pe[0];
-		aey = pa[1] - pe[1];
-		bey = pb[1] - pe[1];
-		cey = pc[1] - pe[1];
-		dey = pd[1] - pe[1];
-		aez = pa[2] - pe[2];
-		bez = pb[2] - pe[2];
-		cez = pc[2] - pe[2];
-		dez = pd[2] - pe[2];
-
-		aexbey = aex * bey;
-		bexaey = bex * aey;
-		ab = aexbey - bexaey;
-		bexcey = bex * cey;
-		cexbey = cex * bey;
-		bc = bexcey - cexbey;
-		cexdey = cex * dey;
-		dexcey = dex * cey;
-		cd = cexdey - dexcey;
-		dexaey = dex * aey;
-		aexdey = aex * dey;
-		da = dexaey - aexdey;
-
-		aexcey = aex * cey;
-		cexaey = cex * aey;
-		ac = aexcey - cexaey;
-		bexdey = bex * dey;
-		dexbey = dex * bey;
-		bd = bexdey - dexbey;
-
-		abc = aez * bc - bez * ac + cez * ab;
-		bcd = bez * cd - cez * bd + dez * bc;
-		cda = cez * da + dez * ac + aez * cd;
-		dab = dez * ab + aez * bd + bez * da;
-
-		alift = aex * aex + aey * aey + aez * aez;
-		blift = bex * bex + bey * bey + bez * bez;
-		clift = cex * cex + cey * cey + cez * cez;
-		dlift = dex * dex + dey * dey + dez * dez;
-
-		det = (dlift * abc - clift * dab) + (blift * cda - alift * bcd);
-
-		aezplus = Absolute(aez);
-		bezplus = Absolute(bez);
-		cezplus = Absolute(cez);
-		dezplus = Absolute(dez);
-		aexbeyplus = Absolute(aexbey);
-		bexaeyplus = Absolute(bexaey);
-		bexceyplus = Absolute(bexcey);
-		cexbeyplus = Absolute(cexbey);
-		cexdeyplus = Absolute(cexdey);
-		dexceyplus = Absolute(dexcey);
-		dexaeyplus = Absolute(dexaey);
-		aexdeyplus = Absolute(aexdey);
-		aexceyplus = Absolute(aexcey);
-		cexaeyplus = Absolute(cexaey);
-		bexdeyplus = Absolute(bexdey);
-		dexbeyplus = Absolute(dexbey);
-		permanent = ((cexdeyplus + dexceyplus) * bezplus
-			+ (dexbeyplus + bexdeyplus) * cezplus
-			+ (bexceyplus + cexbeyplus) * dezplus)
-			* alift
-			+ ((dexaeyplus + aexdeyplus) * cezplus
-				+ (aexceyplus + cexaeyplus) * dezplus
-				+ (cexdeyplus + dexceyplus) * aezplus)
-			* blift
-			+ ((aexbeyplus + bexaeyplus) * dezplus
-				+ (bexdeyplus + dexbeyplus) * aezplus
-				+ (dexaeyplus + aexdeyplus) * bezplus)
-			* clift
-			+ ((bexceyplus + cexbeyplus) * aezplus
-				+ (cexaeyplus + aexceyplus) * bezplus
-				+ (aexbeyplus + bexaeyplus) * cezplus)
-			* dlift;
-		errbound = isperrboundA * permanent;
-		if ((det > errbound) || (-det > errbound)) {
-			return det;
-		}
-
-		return insphereadapt(pa, pb, pc, pd, pe, permanent);
-	}
+	// Bound on the error of the insphere determinant from the largest coordinate differences along each axis, it
+	// bounds isperrboundA times the permanent since every 2x2 product in the permanent is at most maxx*maxy, every
+	// z factor at most maxz and every lift at most maxx^2+maxy^2+maxz^2
+	double const isperrboundS = 24.0 * (16.0 + 224.0 * epsilon) * epsilon * (1.0 + 64.0 * epsilon);
 }
 
 double orient3d(boost::array<Vector3D, 4> const& points)
 {
-	double pa[3], pb[3], pc[3], pd[3];
-	pa[0] = points[0].x;
-	pa[1] = points[0].y;
-	pa[2] = points[0].z;
-	pb[0] = points[1].x;
-	pb[1] = points[1].y;
-	pb[2] = points[1].z;
-	pc[0] = points[2].x;
-	pc[1] = points[2].y;
-	pc[2] = points[2].z;
-	pd[0] = points[3].x;
-	pd[1] = points[3].y;
-	pd[2] = points[3].z;
-	return orient3d(pa,pb,pc,pd);
+	return orient3d(points[0], points[1], points[2], points[3]);
+}
+
+double orient3d(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d)
+{
+	double pa[3] = { a.x, a.y, a.z };
+	double pb[3] = { b.x, b.y, b.z };
+	double pc[3] = { c.x, c.y, c.z };
+	double pd[3] = { d.x, d.y, d.z };
+	return orient3d(pa, pb, pc, pd);
 }
 
 /*double orient2d(boost::array<Vector3D, 3> const& points)
@@ -3545,21 +3445,139 @@ double orient3d(boost::array<Vector3D, 4> const& points)
 
 double insphere(boost::array<Vector3D, 5> const& points)
 {
-	double pa[3], pb[3], pc[3], pd[3],pe[3];
-	pa[0] = points[0].x;
-	pa[1] = points[0].y;
-	pa[2] = points[0].z;
-	pb[0] = points[1].x;
-	pb[1] = points[1].y;
-	pb[2] = points[1].z;
-	pc[0] = points[2].x;
-	pc[1] = points[2].y;
-	pc[2] = points[2].z;
-	pd[0] = points[3].x;
-	pd[1] = points[3].y;
-	pd[2] = points[3].z;
-	pe[0] = points[4].x;
-	pe[1] = points[4].y;
-	pe[2] = points[4].z;
-	return insphere(pa, pb, pc, pd, pe);
-}
\ No newline at end of file
+	return insphere(points[0], points[1], points[2], points[3], points[4]);
+}
+
+double insphere(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d, Vector3D const& e,
+	boost::array<std::size_t, 3> *tier_counts)
+{
+	double const aex = a.x - e.x;
+	double const bex = b.x - e.x;
+	double const cex = c.x - e.x;
+	double const dex = d.x - e.x;
+	double const aey = a.y - e.y;
+	double const bey = b.y - e.y;
+	double const cey = c.y - e.y;
+	double const dey = d.y - e.y;
+	double const aez = a.z - e.z;
+	double const bez = b.z - e.z;
+	double const cez = c.z - e.z;
+	double const dez = d.z - e.z;
+
+	double const aexbey = aex * bey;
+	double const bexaey = bex * aey;
+	double const ab = aexbey - bexaey;
+	double const bexcey = bex * cey;
+	double const cexbey = cex * bey;
+	double const bc = bexcey - cexbey;
+	double const cexdey = cex * dey;
+	double const dexcey = dex * cey;
+	double const cd = cexdey - dexcey;
+	double const dexaey = dex * aey;
+	double const aexdey = aex * dey;
+	double const da = dexaey - aexdey;
+
+	double const aexcey = aex * cey;
+	double const cexaey = cex * aey;
+	double const ac = aexcey - cexaey;
+	double const bexdey = bex * dey;
+	double const dexbey = dex * bey;
+	double const bd = bexdey - dexbey;
+
+	double const abc = aez * bc - bez * ac + cez * ab;
+	double const bcd = bez * cd - cez * bd + dez * bc;
+	double const cda = cez * da + dez * ac + aez * cd;
+	double const dab = dez * ab + aez * bd + bez * da;
+
+	double const alift = aex * aex + aey * aey + aez * aez;
+	double const blift = bex * bex + bey * bey + bez * bez;
+	double const clift = cex * cex + cey * cey + cez * cez;
+	double const dlift = dex * dex + dey * dey + dez * dez;
+
+	double const det = (dlift * abc - clift * dab) + (blift * cda - alift * bcd);
+
+	// First tier, semi static filter
+	double const maxx = std::max(std::max(Absolute(aex), Absolute(bex)), std::max(Absolute(cex), Absolute(dex)));
+	double const maxy = std::max(std::max(Absolute(aey), Absolute(bey)), std::max(Absolute(cey), Absolute(dey)));
+	double const maxz = std::max(std::max(Absolute(aez), Absolute(bez)), std::max(Absolute(cez), Absolute(dez)));
+	double const smallest = std::min(maxx, std::min(maxy, maxz));
+	double const largest = std::max(maxx, std::max(maxy, maxz));
+	// Avoid underflow and overflow of the bound
+	if (smallest > 1e-58 && largest < 1e61)
+	{
+		double const errbound = isperrboundS * maxx * maxy * maxz * (maxx * maxx + maxy * maxy + maxz * maxz);
+		if ((det > errbound) || (-det > errbound))
+		{
+			if (tier_counts)
+				++(*tier_counts)[0];
+			return det;
+		}
+	}
+
+	// Second tier, error bound from the permanent
+	double const permanent = ((Absolute(cexdey) + Absolute(dexcey)) * Absolute(bez)
+		+ (Absolute(dexbey) + Absolute(bexdey)) * Absolute(cez)
+		+ (Absolute(bexcey) + Absolute(cexbey)) * Absolute(dez))
+		* alift
+		+ ((Absolute(dexaey) + Absolute(aexdey)) * Absolute(cez)
+			+ (Absolute(aexcey) + Absolute(cexaey)) * Absolute(dez)
+			+ (Absolute(cexdey) + Absolute(dexcey)) * Absolute(aez))
+		* blift
+		+ ((Absolute(aexbey) + Absolute(bexaey)) * Absolute(dez)
+			+ (Absolute(bexdey) + Absolute(dexbey)) * Absolute(aez)
+			+ (Absolute(dexaey) + Absolute(aexdey)) * Absolute(bez))
+		* clift
+		+ ((Absolute(bexcey) + Absolute(cexbey)) * Absolute(aez)
+			+ (Absolute(cexaey) + Absolute(aexcey)) * Absolute(bez)
+			+ (Absolute(aexbey) + Absolute(bexaey)) * Absolute(cez))
+		* dlift;
+	double const errbound = isperrboundA * permanent;
+	if ((det > errbound) || (-det > errbound))
+	{
+		if (tier_counts)
+			++(*tier_counts)[1];
+		return det;
+	}
+
+	// Third tier, exact arithmetic
+	if (tier_counts)
+		++(*tier_counts)[2];
+	double pa[3] = { a.x, a.y, a.z };
+	double pb[3] = { b.x, b.y, b.z };
+	double pc[3] = { c.x, c.y, c.z };
+	double pd[3] = { d.x, d.y, d.z };
+	double pe[3] = { e.x, e.y, e.z };
+	return insphereadapt(pa, pb, pc, pd, pe, permanent);
+}
+
+double insphere(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d, Vector3D const& e,
+	boost::array<std::size_t, 5> const& indeces, boost::array<std::size_t, 3> *tier_counts)
+{
+	double const det = insphere(a, b, c, d, e, tier_counts);
+	if (det > 0 || det < 0)
+		return det;
+
+	// Simulation of simplicity, the lift of every point is raised by eps^(rank) where the point with the largest index
+	// has the largest perturbation. The perturbed determinant is det+sum(eps^(rank)*C_i) where C_i is the cofactor of
+	// the lift of point i, so its sign is the sign of the first cofactor that is not zero
+	double pts[5][3] = { { a.x, a.y, a.z }, { b.x, b.y, b.z }, { c.x, c.y, c.z }, { d.x, d.y, d.z }, { e.x, e.y, e.z } };
+	boost::array<std::size_t, 5> order = { { 0, 1, 2, 3, 4 } };
+	for (std::size_t i = 1; i < 5; ++i)
+		for (std::size_t j = i; j > 0 && indeces[order[j - 1]] < indeces[order[j]]; --j)
+			std::swap(order[j - 1], order[j]);
+	for (std::size_t i = 0; i < 5; ++i)
+	{
+		std::size_t const k = order[i];
+		double *others[4];
+		std::size_t counter = 0;
+		for (std::size_t j = 0; j < 5; ++j)
+			if (j != k)
+				others[counter++] = pts[j];
+		// The cofactor of the lift of point k is (-1)^(k+1) times the orientation of the other four points
+		double const cofactor = orient3d(others[0], others[1], others[2], others[3]);
+		if (cofactor > 0 || cofactor < 0)
+			return (k % 2 == 1) ? (cofactor > 0 ? 1 : -1) : (cofactor > 0 ? -1 : 1);
+	}
+	// All of the points are coplanar
+	return 0;
+}
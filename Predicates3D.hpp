@@ -8,6 +8,16 @@
 
 double orient3d(boost::array<Vector3D,4> const& points);
 
+double orient3d(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d);
+
 double insphere(boost::array<Vector3D, 5> const& points);
 
+// If tier_counts is given, the tier that resolved the test is counted in it: the semi static filter, the permanent error bound or exact arithmetic
+double insphere(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d, Vector3D const& e,
+	boost::array<std::size_t, 3> *tier_counts = 0);
+
+// Insphere test with symbolic perturbation of the lifts by the point indeces, never returns zero unless all of the points are coplanar
+double insphere(Vector3D const& a, Vector3D const& b, Vector3D const& c, Vector3D const& d, Vector3D const& e,
+	boost::array<std::size_t, 5> const& indeces, boost::array<std::size_t, 3> *tier_counts = 0);
+
 #endif //PREDICATES3D_HPP
\ No newline at end of file
@@ -17,6 +17,8 @@ using std::vector;
 class Tessellation3D
 {
 public:
+	//! \brief Iterator over the neighbors of a cell
+	typedef vector<size_t>::const_iterator NeighborIterator;
 
 	/*! \brief Builds the tessellation
 	\param points Initial position of mesh generating points
@@ -102,6 +104,13 @@ public:
 
 	virtual vector<size_t> GetNeighbors(size_t index)const = 0;
 
+	/*!
+	\brief Returns the neighbors of a cell without copying them, in the same order as GetNeighbors
+	\param index The cell to check
+	\return The first neighbor and one past the last neighbor, valid until the next build
+	*/
+	virtual std::pair<NeighborIterator, NeighborIterator> GetNeighborRange(size_t index)const = 0;
+
 	/*!
 	\brief Cloning function
 	*/
@@ -155,6 +164,36 @@ public:
 	*/
 	virtual vector<Vector3D>& GetAllCM(void) = 0;
 
+	/*!
+	\brief Returns the center of masses of the cells
+	\return The CM's
+	*/
+	virtual vector<Vector3D> const& GetAllCM(void)const = 0;
+
+	/*!
+	\brief Returns the areas of all of the faces, so loops over the faces do not call GetArea for every face
+	\return The areas, indexed by the face
+	*/
+	virtual vector<double> const& GetAllAreas(void)const = 0;
+
+	/*!
+	\brief Returns the volumes of all of the cells
+	\return The volumes, indexed by the cell, only the real cells are included
+	*/
+	virtual vector<double> const& GetAllVolumes(void)const = 0;
+
+	/*!
+	\brief Returns the neighbors of all of the faces
+	\return The neighbors, indexed by the face
+	*/
+	virtual vector<std::pair<size_t, size_t> > const& GetAllFaceNeighbors(void)const = 0;
+
+	/*!
+	\brief Calculates the normals of all of the faces, as in Normal
+	\param normals The normals, indexed by the face
+	*/
+	virtual void GetAllNormals(vector<Vector3D> &normals)const = 0;
+
 	/*!
 	\brief Returns the neighbors and neighbors of the neighbors of a cell
 	\param point The index of the cell to calculate for
@@ -188,6 +227,13 @@ public:
 	*/
 	virtual Vector3D CalcFaceVelocity(size_t index,Vector3D const& v0,Vector3D const& v1)const=0;
 
+	/*!
+	\brief Calculates the velocities of all of the faces in one pass, as in CalcFaceVelocity
+	\param velocities The velocities of all of the points, including the ghosts
+	\param face_velocities The velocities of the faces, indexed by the face
+	*/
+	virtual void CalcAllFaceVelocities(vector<Vector3D> const& velocities, vector<Vector3D> &face_velocities)const = 0;
+
 	virtual Vector3D FaceCM(size_t index)const=0;
 
 	virtual vector<vector<size_t> > const& GetGhostIndeces(void) const = 0;
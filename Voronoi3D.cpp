@@ -8,8 +8,18 @@
 #include "utils.hpp"
 #include <fstream>
 #include <iostream>
+#include <ctime>
+#ifdef _OPENMP
+#include <omp.h>
+#elif !defined(_WIN32)
+#include <sys/time.h>
+#endif
+#include <limits>
 #include <boost/container/flat_map.hpp>
 #include "Intersections.hpp"
+#include "Predicates3D.hpp"
+#include "HilbertOrder3D.hpp"
+#include <boost/cstdint.hpp>
 
 bool PointInPoly(Tessellation3D const& tess, Vector3D const& point, std::size_t index)
 {
@@ -31,24 +41,37 @@ bool PointInPoly(Tessellation3D const& tess, Vector3D const& point, std::size_t
 
 namespace
 {
+	// Wall clock time in seconds, the build time is used for load balancing so it has to include the time spent waiting
+	double WallTime(void)
+	{
+#ifdef _OPENMP
+		return omp_get_wtime();
+#elif defined(_WIN32)
+		// The Windows clock counts wall time
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#else
+		timeval tv;
+		gettimeofday(&tv, 0);
+		return static_cast<double>(tv.tv_sec) + 1e-6 * static_cast<double>(tv.tv_usec);
+#endif
+	}
+
 	void FirstCheckList(std::stack<std::size_t > &check_stack, vector<bool> &future_check, size_t Norg,
 		Delaunay3D const& del)
 	{
-		check_stack.empty();;
+		// The points next to the large tetra and the ghosts are found from the tetras around these points
 		future_check.resize(Norg, false);
-		size_t Ntetra = del.tetras_.size();
-		for (size_t i = 0; i < Ntetra; ++i)
+		vector<size_t> tetras;
+		size_t const Npoints = del.points_.size();
+		for (size_t i = Norg; i < Npoints; ++i)
 		{
-			Tetrahedron const& tetra = del.tetras_[i];
-			for (size_t j = 0; j < 4; ++j)
+			del.GetPointTetras(i, tetras);
+			for (size_t j = 0; j < tetras.size(); ++j)
 			{
-				if (tetra.points[j] > Norg)
-				{
-					for (size_t k = 0; k < 4; ++k)
-						if (tetra.points[k] < Norg)
-							future_check[tetra.points[k]] = true;
-					break;
-				}
+				Tetrahedron const& tetra = del.tetras_[tetras[j]];
+				for (size_t k = 0; k < 4; ++k)
+					if (tetra.points[k] < Norg)
+						future_check[tetra.points[k]] = true;
 			}
 		}
 		for (size_t i = 0; i < Norg; ++i)
@@ -99,6 +122,72 @@ namespace
 		return res;
 	}
 
+	// The translation that takes a point near each face of BuildBox to the outside of the opposite face
+	vector<Vector3D> GetPeriodicShifts(Vector3D const& ll, Vector3D const& ur)
+	{
+		Vector3D const L = ur - ll;
+		vector<Vector3D> res(6);
+		res[0] = Vector3D(0, 0, L.z);
+		res[1] = Vector3D(0, L.y, 0);
+		res[2] = Vector3D(L.x, 0, 0);
+		res[3] = Vector3D(0, -L.y, 0);
+		res[4] = Vector3D(-L.x, 0, 0);
+		res[5] = Vector3D(0, 0, -L.z);
+		return res;
+	}
+
+	// The distance of a point from the plane of a face of BuildBox
+	double BoxFaceDistance(Vector3D const& point, Vector3D const& ll, Vector3D const& ur, std::size_t face)
+	{
+		switch (face)
+		{
+		case 0:
+			return point.z - ll.z;
+		case 1:
+			return point.y - ll.y;
+		case 2:
+			return point.x - ll.x;
+		case 3:
+			return ur.y - point.y;
+		case 4:
+			return ur.x - point.x;
+		default:
+			return ur.z - point.z;
+		}
+	}
+
+	// True if the set of box faces contains two opposite faces
+	bool HasOppositeFaces(std::size_t faces)
+	{
+		return ((faces & 4) && (faces & 16)) || ((faces & 2) && (faces & 8)) || ((faces & 1) && (faces & 32));
+	}
+
+	// Adds the copies of the points through the wanted faces that were not added before. A point near an edge or a
+	// corner is also copied diagonally, by every combination of its faces
+	void AddPeriodicCopies(vector<Vector3D> const& points, vector<std::size_t> const& wanted, vector<Vector3D> const& shifts,
+		vector<std::size_t> &duplicated, vector<Vector3D> &extra_points, vector<std::size_t> &sources)
+	{
+		for (std::size_t point = 0; point < wanted.size(); ++point)
+		{
+			std::size_t const old_faces = duplicated[point];
+			std::size_t const new_faces = old_faces | wanted[point];
+			if (new_faces == old_faces)
+				continue;
+			for (std::size_t subset = 1; subset < 64; ++subset)
+			{
+				if ((subset & ~new_faces) || !(subset & ~old_faces) || HasOppositeFaces(subset))
+					continue;
+				Vector3D shift;
+				for (std::size_t j = 0; j < 6; ++j)
+					if (subset & (static_cast<std::size_t>(1) << j))
+						shift += shifts[j];
+				extra_points.push_back(points[point] + shift);
+				sources.push_back(point);
+			}
+			duplicated[point] = new_faces;
+		}
+	}
+
 	vector<Vector3D> GetBoxNormals(Vector3D const& ll,Vector3D const& ur)
 	{
 		vector<Face> faces = BuildBox(ll, ur);
@@ -124,6 +213,115 @@ namespace
 		return loc;
 	}
 
+	// Number of tetras in a block of the batch circumcenter kernel
+	std::size_t const circumcenter_block = 64;
+
+	// A tetra whose volume is smaller than this fraction of the magnitude of the terms in its determinant is treated as a
+	// sliver, the double precision determinant has too few correct digits to place its circumcenter
+	double const sliver_condition = 1e-8;
+
+	// Calculates the circumcenter of a tetra relative to its first point and the circumradius. The input are the edges
+	// from the first point, the 2x2 minors are shared between the determinant and the three numerators
+	inline double TetraCircumcenter(double x2, double y2, double z2, double x3, double y3, double z3, double x4,
+		double y4, double z4, double &cx, double &cy, double &cz, bool &sliver)
+	{
+		double const l2 = x2 * x2 + y2 * y2 + z2 * z2;
+		double const l3 = x3 * x3 + y3 * y3 + z3 * z3;
+		double const l4 = x4 * x4 + y4 * y4 + z4 * z4;
+		double const yz34 = Det22(y3, z3, y4, z4);
+		double const yz42 = Det22(y4, z4, y2, z2);
+		double const yz23 = Det22(y2, z2, y3, z3);
+		double const xz34 = Det22(x3, z3, x4, z4);
+		double const xz42 = Det22(x4, z4, x2, z2);
+		double const xz23 = Det22(x2, z2, x3, z3);
+		double const xy34 = Det22(x3, y3, x4, y4);
+		double const xy42 = Det22(x4, y4, x2, y2);
+		double const xy23 = Det22(x2, y2, x3, y3);
+		double const a = MulAdd(x2, yz34, MulAdd(x3, yz42, x4 * yz23));
+		double const Dx = MulAdd(l2, yz34, MulAdd(l3, yz42, l4 * yz23));
+		double const Dy = -MulAdd(l2, xz34, MulAdd(l3, xz42, l4 * xz23));
+		double const Dz = MulAdd(l2, xy34, MulAdd(l3, xy42, l4 * xy23));
+		// The roundoff in the determinant is a few epsilon of the sum of the absolute values of its terms
+		sliver = std::abs(a) < sliver_condition * (std::abs(x2 * yz34) + std::abs(x3 * yz42) + std::abs(x4 * yz23));
+		double const inv = 0.5 / a;
+		cx = Dx * inv;
+		cy = Dy * inv;
+		cz = Dz * inv;
+		return std::sqrt(Dx * Dx + Dy * Dy + Dz * Dz) * std::abs(inv);
+	}
+
+	// Circumcenter and circumradius of a sliver tetra. The volume determinant is evaluated from the original
+	// coordinates with the adaptive exact orientation predicate, so it keeps its relative accuracy even when the
+	// tetra is almost flat, the numerators are not ill conditioned and stay in double precision
+	double SliverCircumcenter(Vector3D const& p0, Vector3D const& p1, Vector3D const& p2, Vector3D const& p3,
+		Vector3D &center)
+	{
+		Vector3D const v2 = p1 - p0;
+		Vector3D const v3 = p2 - p0;
+		Vector3D const v4 = p3 - p0;
+		double const l2 = ScalarProd(v2, v2);
+		double const l3 = ScalarProd(v3, v3);
+		double const l4 = ScalarProd(v4, v4);
+		double const Dx = Det33(l2, v2.y, v2.z, l3, v3.y, v3.z, l4, v4.y, v4.z);
+		double const Dy = -Det33(l2, v2.x, v2.z, l3, v3.x, v3.z, l4, v4.x, v4.z);
+		double const Dz = Det33(l2, v2.x, v2.y, l3, v3.x, v3.y, l4, v4.x, v4.y);
+		double const a = orient3d(p1, p2, p3, p0);
+		double const inv = 0.5 / a;
+		center = p0 + Vector3D(Dx * inv, Dy * inv, Dz * inv);
+		return std::sqrt(Dx * Dx + Dy * Dy + Dz * Dz) * std::abs(inv);
+	}
+
+	// The velocity of the face between r0 and r1 with the centroid f, the average velocity plus the correction that keeps the face the bisector
+	Vector3D FaceVelocity(Vector3D const& r0, Vector3D const& r1, Vector3D const& f, Vector3D const& v0, Vector3D const& v1)
+	{
+		Vector3D const r_diff = r1 - r0;
+		Vector3D const delta_w = ScalarProd(v0 - v1, f - 0.5 * (r1 + r0)) * r_diff / ScalarProd(r_diff, r_diff);
+		return 0.5 * (v0 + v1) + delta_w;
+	}
+
+	// Circumcenter and circumradius of a tetra
+	double TetraRadiusCenter(Vector3D const& p0, Vector3D const& p1, Vector3D const& p2, Vector3D const& p3,
+		Vector3D &center)
+	{
+		double cx, cy, cz;
+		bool sliver;
+		double const R = TetraCircumcenter(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z, p2.x - p0.x, p2.y - p0.y, p2.z - p0.z,
+			p3.x - p0.x, p3.y - p0.y, p3.z - p0.z, cx, cy, cz, sliver);
+		if (sliver)
+			return SliverCircumcenter(p0, p1, p2, p3, center);
+		center = Vector3D(cx + p0.x, cy + p0.y, cz + p0.z);
+		return R;
+	}
+
+	// Area of a face and its area weighted centroid, the weights of the fan triangles are their areas projected on the face normal
+	double FaceAreaCentroid(vector<size_t> const& face, vector<Vector3D> const& vertices, Vector3D &centroid)
+	{
+		size_t const Nloop = face.size() - 2;
+		Vector3D const& p0 = vertices[face[0]];
+		Vector3D normal;
+		for (size_t j = 0; j < Nloop; ++j)
+			normal += CrossProduct(vertices[face[j + 2]] - p0, vertices[face[j + 1]] - p0);
+		double const twice_area = abs(normal);
+		centroid = Vector3D();
+		if (twice_area > 0)
+		{
+			for (size_t j = 0; j < Nloop; ++j)
+			{
+				Vector3D const& p1 = vertices[face[j + 1]];
+				Vector3D const& p2 = vertices[face[j + 2]];
+				centroid += ScalarProd(CrossProduct(p2 - p0, p1 - p0), normal) * (p0 + p1 + p2);
+			}
+			centroid = centroid / (3 * twice_area * twice_area);
+		}
+		else
+		{
+			for (size_t j = 0; j < face.size(); ++j)
+				centroid += vertices[face[j]];
+			centroid = centroid / static_cast<double>(face.size());
+		}
+		return 0.5 * twice_area;
+	}
+
 	void CleanDuplicates(vector<size_t> &indeces, vector<Vector3D> const& points, vector<size_t> &res, double R)
 	{
 		res.clear();
@@ -139,39 +337,6 @@ namespace
 			res.pop_back();
 	}
 
-	size_t SetPointTetras(vector<vector<size_t> > &PointTetras, size_t Norg, vector<Tetrahedron> const& tetras,
-		std::set<size_t> const& empty_tetras)
-	{
-		PointTetras.clear();
-		PointTetras.resize(Norg);
-		size_t Ntetra = tetras.size();
-		size_t bigtet(0);
-		bool has_good, has_big;
-		for (size_t i = 0; i < Ntetra; ++i)
-		{
-			if (empty_tetras.find(i) == empty_tetras.end())
-			{
-				has_good = false;
-				has_big = false;
-				for (size_t j = 0; j < 4; ++j)
-				{
-					size_t temp = tetras[i].points[j];
-					if (temp < Norg)
-					{
-						PointTetras[temp].push_back(i);
-						has_good = true;
-					}
-					else
-						//if (temp < Norg + 4)
-						has_big = true;
-				}
-				if (has_big&&has_good)
-					bigtet = i;
-			}
-		}
-		return bigtet;
-	}
-
 	void MakeRightHandFace(vector<size_t> &indeces, Vector3D const& point, vector<Vector3D> const& face_points,
 		vector<size_t> &temp)
 	{
@@ -268,20 +433,103 @@ namespace
 				new_talk_with_me.push_back(to_talk_with[i]);
 		to_talk_with = new_talk_with_me;
 	}
-#endif //RICH_MPI
 
-	double CalcFaceArea(vector<std::size_t> const& indeces, vector<Vector3D> const& points)
+	void AddTalkingProcs(vector<int> &sentproc, vector<vector<std::size_t> > &sentpoints)
 	{
-		std::size_t Nloop = indeces.size() - 2;
-		Vector3D temp;
-		for (std::size_t i = 0; i < Nloop; ++i)
-			temp += CrossProduct(points[indeces[i + 2]] - points[indeces[0]], points[indeces[i + 1]] - points[indeces[0]]);
-		return 0.5*abs(temp);
+		int wsize;
+		MPI_Comm_size(MPI_COMM_WORLD, &wsize);
+		vector<int> totalk(static_cast<std::size_t>(wsize), 0);
+		vector<int> scounts(totalk.size(), 1);
+		for (std::size_t i = 0; i < sentproc.size(); ++i)
+			totalk[sentproc[i]] = 1;
+		int nrecv;
+		MPI_Reduce_scatter(&totalk[0], &nrecv, &scounts[0], MPI_INT, MPI_SUM,
+			MPI_COMM_WORLD);
+
+		vector<MPI_Request> req(sentproc.size());
+		for (std::size_t i = 0; i < sentproc.size(); ++i)
+			MPI_Isend(&wsize, 1, MPI_INT, sentproc[i], 3, MPI_COMM_WORLD, &req[i]);
+		vector<int> talkwithme;
+		for (int i = 0; i < nrecv; ++i)
+		{
+			MPI_Status status;
+			MPI_Recv(&wsize, 1, MPI_INT, MPI_ANY_SOURCE, 3, MPI_COMM_WORLD, &status);
+			talkwithme.push_back(status.MPI_SOURCE);
+		}
+		if (!req.empty())
+			MPI_Waitall(static_cast<int>(req.size()), &req[0], MPI_STATUSES_IGNORE);
+		MPI_Barrier(MPI_COMM_WORLD);
+		for (std::size_t i = 0; i < talkwithme.size(); ++i)
+		{
+			if (std::find(sentproc.begin(), sentproc.end(), talkwithme[i]) == sentproc.end())
+			{
+				sentproc.push_back(talkwithme[i]);
+				sentpoints.push_back(vector<std::size_t>());
+			}
+		}
+	}
+
+	vector<std::pair<Vector3D, Vector3D> > GatherBoundingBoxes(vector<Vector3D> const& points, std::size_t Npoints)
+	{
+		double const big = std::numeric_limits<double>::max();
+		double send[6] = { big, big, big, -big, -big, -big };
+		for (std::size_t i = 0; i < Npoints; ++i)
+		{
+			send[0] = std::min(send[0], points[i].x);
+			send[1] = std::min(send[1], points[i].y);
+			send[2] = std::min(send[2], points[i].z);
+			send[3] = std::max(send[3], points[i].x);
+			send[4] = std::max(send[4], points[i].y);
+			send[5] = std::max(send[5], points[i].z);
+		}
+		int wsize;
+		MPI_Comm_size(MPI_COMM_WORLD, &wsize);
+		vector<double> recv(6 * static_cast<std::size_t>(wsize));
+		MPI_Allgather(send, 6, MPI_DOUBLE, &recv[0], 6, MPI_DOUBLE, MPI_COMM_WORLD);
+		vector<std::pair<Vector3D, Vector3D> > res(static_cast<std::size_t>(wsize));
+		for (std::size_t i = 0; i < res.size(); ++i)
+		{
+			res[i].first = Vector3D(recv[6 * i], recv[6 * i + 1], recv[6 * i + 2]);
+			res[i].second = Vector3D(recv[6 * i + 3], recv[6 * i + 4], recv[6 * i + 5]);
+		}
+		return res;
 	}
 
-	bool PointInVertices(b_array_4 const& points, std::size_t point)
+	bool SphereBoxIntersection(Sphere const& sphere, std::pair<Vector3D, Vector3D> const& box)
+	{
+		double dist = 0;
+		if (sphere.center.x < box.first.x)
+			dist += (box.first.x - sphere.center.x)*(box.first.x - sphere.center.x);
+		else if (sphere.center.x > box.second.x)
+			dist += (sphere.center.x - box.second.x)*(sphere.center.x - box.second.x);
+		if (sphere.center.y < box.first.y)
+			dist += (box.first.y - sphere.center.y)*(box.first.y - sphere.center.y);
+		else if (sphere.center.y > box.second.y)
+			dist += (sphere.center.y - box.second.y)*(sphere.center.y - box.second.y);
+		if (sphere.center.z < box.first.z)
+			dist += (box.first.z - sphere.center.z)*(box.first.z - sphere.center.z);
+		else if (sphere.center.z > box.second.z)
+			dist += (sphere.center.z - box.second.z)*(sphere.center.z - box.second.z);
+		return dist <= sphere.radius*sphere.radius;
+	}
+#endif //RICH_MPI
+
+	// Returns a tetra with both real and other points from the tetras around the points that were added from Nstart
+	size_t FindGhostTetra(Delaunay3D const& del, size_t Nstart, size_t bigtet)
 	{
-		return !(std::find(points.begin(), points.end(), point) == points.end());
+		vector<size_t> tetras;
+		size_t const Npoints = del.points_.size();
+		for (size_t i = Nstart; i < Npoints; ++i)
+		{
+			del.GetPointTetras(i, tetras);
+			for (size_t j = 0; j < tetras.size(); ++j)
+			{
+				b_array_4 const& points = del.tetras_[tetras[j]].points;
+				if (std::min(std::min(points[0], points[1]), std::min(points[2], points[3])) < del.Norg_)
+					return tetras[j];
+			}
+		}
+		return bigtet;
 	}
 
 	bool PointInDomain(Vector3D const& ll, Vector3D const& ur, Vector3D const& point)
@@ -292,6 +540,40 @@ namespace
 			return false;
 	}
 
+	boost::uint64_t const checkpoint_magic = 0x31524F5648434952ULL; // "RICHVOR1"
+	// Version 1 had no header of its own, version 2 added the header and the periodic flag
+	boost::uint64_t const checkpoint_version = 2;
+
+	void WriteIndeces(std::ostream &fh, vector<vector<std::size_t> > const& data)
+	{
+		vector<boost::uint64_t> temp(1, data.size());
+		for (std::size_t i = 0; i < data.size(); ++i)
+			temp.push_back(data[i].size());
+		for (std::size_t i = 0; i < data.size(); ++i)
+			temp.insert(temp.end(), data[i].begin(), data[i].end());
+		fh.write(reinterpret_cast<const char*>(&temp[0]), static_cast<std::streamsize>(temp.size() * sizeof(boost::uint64_t)));
+	}
+
+	void ReadIndeces(std::istream &fh, vector<vector<std::size_t> > &data)
+	{
+		boost::uint64_t N = 0;
+		fh.read(reinterpret_cast<char*>(&N), sizeof(boost::uint64_t));
+		vector<boost::uint64_t> sizes(static_cast<std::size_t>(N));
+		if (N > 0)
+			fh.read(reinterpret_cast<char*>(&sizes[0]), static_cast<std::streamsize>(N * sizeof(boost::uint64_t)));
+		data.resize(static_cast<std::size_t>(N));
+		vector<boost::uint64_t> temp;
+		for (std::size_t i = 0; i < data.size(); ++i)
+		{
+			temp.resize(static_cast<std::size_t>(sizes[i]));
+			if (!temp.empty())
+				fh.read(reinterpret_cast<char*>(&temp[0]), static_cast<std::streamsize>(temp.size() * sizeof(boost::uint64_t)));
+			data[i].assign(temp.begin(), temp.end());
+		}
+		if (!fh.good())
+			throw UniversalError("Truncated Voronoi3D checkpoint");
+	}
+
 	Vector3D MirrorPoint(Face const& face, Vector3D const& point)
 	{
 		Vector3D normal = CrossProduct(face.vertices[1] - face.vertices[0], face.vertices[2] - face.vertices[0]);
@@ -372,37 +654,7 @@ vector<Vector3D> Voronoi3D::UpdateMPIPoints(Tessellation3D const& vproc, int ran
 		throw eo;
 	}
 	// Send/Recv the points
-	// Communication
-	int wsize;
-	MPI_Comm_size(MPI_COMM_WORLD, &wsize);
-	vector<int> totalk(static_cast<std::size_t>(wsize), 0);
-	vector<int> scounts(totalk.size(), 1);
-	for (std::size_t i = 0; i < sentproc.size(); ++i)
-		totalk[sentproc[i]] = 1;
-	int nrecv;
-	MPI_Reduce_scatter(&totalk[0], &nrecv, &scounts[0], MPI_INT, MPI_SUM,
-		MPI_COMM_WORLD);
-
-	vector<MPI_Request> req(sentproc.size());
-	for (std::size_t i = 0; i < sentproc.size(); ++i)
-		MPI_Isend(&wsize, 1, MPI_INT, sentproc[i], 3, MPI_COMM_WORLD, &req[i]);
-	vector<int> talkwithme;
-	for (int i = 0; i < nrecv; ++i)
-	{
-		MPI_Status status;
-		MPI_Recv(&wsize, 1, MPI_INT, MPI_ANY_SOURCE, 3, MPI_COMM_WORLD, &status);
-		talkwithme.push_back(status.MPI_SOURCE);
-	}
-	MPI_Waitall(static_cast<int>(req.size()), &req[0], MPI_STATUSES_IGNORE);
-	MPI_Barrier(MPI_COMM_WORLD);
-	for (std::size_t i = 0; i < talkwithme.size(); ++i)
-	{
-		if (std::find(sentproc.begin(), sentproc.end(), talkwithme[i]) == sentproc.end())
-		{
-			sentproc.push_back(talkwithme[i]);
-			sentpoints.push_back(vector<std::size_t>());
-		}
-	}
+	AddTalkingProcs(sentproc, sentpoints);
 	// Point exchange
 	vector<vector<Vector3D> > incoming = MPI_exchange_data(sentproc, sentpoints, points);
 	// Combine the vectors
@@ -414,12 +666,220 @@ vector<Vector3D> Voronoi3D::UpdateMPIPoints(Tessellation3D const& vproc, int ran
 #endif //RICH_MPI
 
 
-Voronoi3D::Voronoi3D()
+Voronoi3D::Voronoi3D() :periodic_(false), lazy_(false), face_geometry_dirty_(false), cell_geometry_dirty_(false),
+	visit_epoch_(0), build_time_(0)
 {}
 
-Voronoi3D::Voronoi3D(Vector3D const& ll, Vector3D const& ur) :ll_(ll), ur_(ur) {}
+Voronoi3D::Voronoi3D(Vector3D const& ll, Vector3D const& ur, bool periodic) :ll_(ll), ur_(ur), periodic_(periodic),
+	lazy_(false), face_geometry_dirty_(false), cell_geometry_dirty_(false), visit_epoch_(0), build_time_(0) {}
+
+void Voronoi3D::SetLazyGeometry(bool lazy)
+{
+	lazy_ = lazy;
+}
 
-void Voronoi3D::CalcRigidCM(std::size_t face_index)
+void Voronoi3D::CreatePeriodicPoints(void)
+{
+	vector<Vector3D> shifts = GetPeriodicShifts(ll_, ur_);
+	std::size_t const opposite[6] = { 5, 3, 4, 1, 2, 0 };
+	// The box faces that each point was already duplicated through, as a bit mask
+	vector<std::size_t> duplicated(Norg_, 0);
+	vector<std::size_t> faces(Norg_, 0), wanted(Norg_, 0);
+	periodic_sources_.clear();
+	for (bool first = true;; first = false)
+	{
+		// The faces that the spheres of each point intersect
+		vector<std::pair<std::size_t, std::size_t> > ghost_index = SerialFindIntersections();
+		std::fill(faces.begin(), faces.end(), 0);
+		std::fill(wanted.begin(), wanted.end(), 0);
+		vector<std::size_t> touched;
+		for (std::size_t i = 0; i < ghost_index.size(); ++i)
+		{
+			std::size_t const point = ghost_index[i].second;
+			if (faces[point] == 0)
+				touched.push_back(point);
+			faces[point] |= static_cast<std::size_t>(1) << ghost_index[i].first;
+		}
+		for (std::size_t i = 0; i < touched.size(); ++i)
+		{
+			std::size_t const point = touched[i];
+			if (!first)
+			{
+				wanted[point] = faces[point];
+				continue;
+			}
+			// The spheres of the large tetra cross most of the box, so the first layer only uses the nearest face
+			double min_dist = std::numeric_limits<double>::max();
+			for (std::size_t j = 0; j < 6; ++j)
+			{
+				double const dist = BoxFaceDistance(del_.points_[point], ll_, ur_, j);
+				if ((faces[point] & (static_cast<std::size_t>(1) << j)) && dist < min_dist)
+				{
+					min_dist = dist;
+					wanted[point] = static_cast<std::size_t>(1) << j;
+				}
+			}
+		}
+		vector<Vector3D> extra_points;
+		vector<std::size_t> sources;
+		AddPeriodicCopies(del_.points_, wanted, shifts, duplicated, extra_points, sources);
+		if (extra_points.empty() && !first)
+		{
+			// The copies near the spheres are in place, make sure that no copy that was not added can be inside the
+			// sphere of a real point by adding every point closer to a face than the spheres reach out of the opposite face
+			double reach[6] = { 0, 0, 0, 0, 0, 0 };
+			for (std::size_t i = 0; i < touched.size(); ++i)
+			{
+				del_.GetPointTetras(touched[i], point_tetras_temp_);
+				for (std::size_t j = 0; j < point_tetras_temp_.size(); ++j)
+				{
+					std::size_t const tetra = point_tetras_temp_[j];
+					if (IsOuterTetra(Norg_, del_.tetras_[tetra]))
+						continue;
+					double const R = GetRadius(tetra);
+					for (std::size_t k = 0; k < 6; ++k)
+						reach[k] = std::max(reach[k], R - BoxFaceDistance(tetra_centers_[tetra], ll_, ur_, k));
+				}
+			}
+			for (std::size_t i = 0; i < Norg_; ++i)
+				for (std::size_t j = 0; j < 6; ++j)
+					if (BoxFaceDistance(del_.points_[i], ll_, ur_, j) < reach[opposite[j]])
+						wanted[i] |= static_cast<std::size_t>(1) << j;
+			AddPeriodicCopies(del_.points_, wanted, shifts, duplicated, extra_points, sources);
+		}
+		if (extra_points.empty())
+			break;
+		std::size_t const Nstart = del_.points_.size();
+		del_.BuildExtra(extra_points);
+		periodic_sources_.insert(periodic_sources_.end(), sources.begin(), sources.end());
+		R_.resize(del_.tetras_.size());
+		std::fill(R_.begin(), R_.end(), -1);
+		tetra_centers_.resize(R_.size());
+		bigtet_ = FindGhostTetra(del_, Nstart, bigtet_);
+	}
+}
+
+void Voronoi3D::CalcPeriodicCM(void)const
+{
+	std::size_t const Nstart = Norg_ + 4;
+	for (std::size_t i = 0; i < periodic_sources_.size(); ++i)
+	{
+		std::size_t const source = periodic_sources_[i];
+		CM_[Nstart + i] = CM_[source] + (del_.points_[Nstart + i] - del_.points_[source]);
+	}
+}
+
+std::size_t Voronoi3D::GetOriginalIndex(std::size_t index) const
+{
+	if (!periodic_ || index < Norg_ + 4)
+		return index;
+	return periodic_sources_[index - Norg_ - 4];
+}
+
+vector<std::size_t> Voronoi3D::Reorder(void)
+{
+	// The Hilbert order of the triangulation, or a new one if the triangulation was read from a checkpoint
+	vector<std::size_t> order(Norg_);
+	if (del_.hilbert_rank_.size() == Norg_)
+	{
+		for (std::size_t i = 0; i < Norg_; ++i)
+			order[del_.hilbert_rank_[i]] = i;
+	}
+	else
+		order = HilbertOrder3D(vector<Vector3D>(del_.points_.begin(), del_.points_.begin() + static_cast<long>(Norg_)));
+#ifdef RICH_MPI
+	// The cells of the points of this processor stay first, each part keeps its Hilbert order
+	vector<std::size_t> received;
+	std::size_t Nself = 0;
+	for (std::size_t i = 0; i < Norg_; ++i)
+	{
+		if (order[i] < self_index_.size())
+			order[Nself++] = order[i];
+		else
+			received.push_back(order[i]);
+	}
+	std::copy(received.begin(), received.end(), order.begin() + static_cast<long>(Nself));
+	vector<std::size_t> self_index(self_index_.size());
+	for (std::size_t i = 0; i < self_index.size(); ++i)
+		self_index[i] = self_index_[order[i]];
+	self_index_ = self_index;
+#endif
+	std::size_t const Npoints = del_.points_.size();
+	vector<std::size_t> new_index(Npoints);
+	for (std::size_t i = 0; i < Npoints; ++i)
+		new_index[i] = i;
+	for (std::size_t i = 0; i < Norg_; ++i)
+		new_index[order[i]] = i;
+	del_.ReorderPoints(order);
+
+	// Renumber the faces, the first neighbor stays the smaller one and the face stays right handed with regard to it
+	std::size_t const Nfaces = FaceNeighbors_.size();
+	vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t> > face_order(Nfaces);
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		std::size_t N0 = new_index[FaceNeighbors_[i].first];
+		std::size_t N1 = new_index[FaceNeighbors_[i].second];
+		if (N0 > N1)
+		{
+			std::swap(N0, N1);
+			std::reverse(PointsInFace_[i].begin(), PointsInFace_[i].end());
+		}
+		face_order[i] = std::make_pair(std::make_pair(N0, N1), i);
+	}
+	std::sort(face_order.begin(), face_order.end());
+	vector<vector<std::size_t> > points_in_face(Nfaces);
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		FaceNeighbors_[i] = face_order[i].first;
+		points_in_face[i].swap(PointsInFace_[face_order[i].second]);
+	}
+	PointsInFace_.swap(points_in_face);
+	if (!face_geometry_dirty_)
+	{
+		vector<double> area(Nfaces);
+		vector<Vector3D> face_cm(Nfaces);
+		for (std::size_t i = 0; i < Nfaces; ++i)
+		{
+			area[i] = area_[face_order[i].second];
+			face_cm[i] = face_cm_[face_order[i].second];
+		}
+		area_.swap(area);
+		face_cm_.swap(face_cm);
+	}
+	// The faces of every cell are added in increasing order, as in BuildVoronoi
+	for (std::size_t i = 0; i < Norg_; ++i)
+		FacesInCell_[i].clear();
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		FacesInCell_[FaceNeighbors_[i].first].push_back(i);
+		if (FaceNeighbors_[i].second < Norg_)
+			FacesInCell_[FaceNeighbors_[i].second].push_back(i);
+	}
+	BuildNeighborList();
+
+	if (!cell_geometry_dirty_)
+	{
+		vector<double> volume(Norg_);
+		vector<Vector3D> CM(Norg_);
+		for (std::size_t i = 0; i < Norg_; ++i)
+		{
+			volume[i] = volume_[order[i]];
+			CM[i] = CM_[order[i]];
+		}
+		std::copy(volume.begin(), volume.end(), volume_.begin());
+		std::copy(CM.begin(), CM.end(), CM_.begin());
+	}
+	for (std::size_t i = 0; i < periodic_sources_.size(); ++i)
+		periodic_sources_[i] = new_index[periodic_sources_[i]];
+	for (std::size_t i = 0; i < duplicated_points_.size(); ++i)
+	{
+		for (std::size_t j = 0; j < duplicated_points_[i].size(); ++j)
+			duplicated_points_[i][j] = new_index[duplicated_points_[i][j]];
+	}
+	return order;
+}
+
+void Voronoi3D::CalcRigidCM(std::size_t face_index)const
 {
 	Vector3D normal = normalize(del_.points_[FaceNeighbors_[face_index].first] - del_.points_[FaceNeighbors_[face_index].second]);
 	std::size_t real, other;
@@ -436,12 +896,25 @@ void Voronoi3D::CalcRigidCM(std::size_t face_index)
 	CM_[other] = CM_[real] - 2 * normal*ScalarProd(normal, CM_[real] - tetra_centers_[PointsInFace_[face_index][0]]);
 }
 
-vector<Vector3D> Voronoi3D::CreateBoundaryPoints(vector<std::pair<std::size_t, std::size_t> > const& to_duplicate)
+vector<Vector3D> Voronoi3D::CreateBoundaryPoints(vector<std::pair<std::size_t, std::size_t> > const& to_duplicate,
+	vector<std::size_t> &seeds)
 {
 	vector<Face> faces = BuildBox(ll_, ur_);
-	vector<Vector3D> res;
-	for (std::size_t i = 0; i < to_duplicate.size(); ++i)
-		res.push_back(MirrorPoint(faces[to_duplicate[i].first], del_.points_[to_duplicate[i].second]));
+	// Mirror the points face by face in the Hilbert order of their originals, so that consecutive ghosts are close
+	std::size_t const N = to_duplicate.size();
+	vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t> > order(N);
+	for (std::size_t i = 0; i < N; ++i)
+		order[i] = std::make_pair(std::make_pair(to_duplicate[i].first, del_.hilbert_rank_[to_duplicate[i].second]), i);
+	std::sort(order.begin(), order.end());
+	vector<Vector3D> res(N);
+	seeds.resize(N);
+	for (std::size_t i = 0; i < N; ++i)
+	{
+		std::pair<std::size_t, std::size_t> const& duplicate = to_duplicate[order[i].second];
+		res[i] = MirrorPoint(faces[duplicate.first], del_.points_[duplicate.second]);
+		// The ghost is next to its original, so the walk starts from one of its tetras
+		seeds[i] = del_.point_tetra_[duplicate.second];
+	}
 	return res;
 }
 
@@ -554,7 +1027,126 @@ vector<Vector3D> Voronoi3D::CreateBoundaryPointsMPI(vector<std::pair<std::size_t
 	for (std::size_t i = 0; i < toadd.size(); ++i)
 		for (std::size_t j = 0; j < toadd[i].size(); ++j)
 		{
-			Nghost_[i].push_back(Norg_ + 4 + res.size());
+			Nghost_[i].push_back(del_.points_.size() + res.size());
+			res.push_back(toadd[i][j]);
+		}
+	return res;
+}
+
+vector<Vector3D> Voronoi3D::CreateBoundaryPointsHilbert(vector<std::pair<Vector3D, Vector3D> > const& boxes,
+	bool first_round, vector<vector<size_t> > &self_duplicate)
+{
+	std::size_t const Nprocs = duplicatedprocs_.size();
+	vector<vector<size_t> > to_send(Nprocs);
+	vector<Face> box_faces = BuildBox(ll_, ur_);
+	vector<vector<size_t> > box_candidates(box_faces.size());
+	self_duplicate.resize(box_faces.size());
+	duplicated_points_.resize(Nprocs);
+	Sphere sphere;
+	if (first_round)
+	{
+		// Every tetra whose sphere reaches the box of another processor sends its points there
+		std::size_t const Ntetra = del_.tetras_.size();
+		for (std::size_t i = 0; i < Ntetra; ++i)
+		{
+			if (del_.empty_tetras_.find(i) != del_.empty_tetras_.end())
+				continue;
+			b_array_4 const& tpoints = del_.tetras_[i].points;
+			if (tpoints[0] >= Norg_ && tpoints[1] >= Norg_ && tpoints[2] >= Norg_ && tpoints[3] >= Norg_)
+				continue;
+			sphere.radius = GetRadius(i);
+			sphere.center = tetra_centers_[i];
+			for (std::size_t j = 0; j < Nprocs; ++j)
+				if (SphereBoxIntersection(sphere, boxes[static_cast<std::size_t>(duplicatedprocs_[j])]))
+					for (std::size_t k = 0; k < 4; ++k)
+						if (tpoints[k] < Norg_)
+							to_send[j].push_back(tpoints[k]);
+		}
+	}
+	else
+	{
+		// Walk from the points near the ghosts and also look for the outer box
+		std::stack<std::size_t > check_stack;
+		vector<std::size_t> point_neigh;
+		vector<bool> checked(Norg_, false), will_check(Norg_, false);
+		FirstCheckList(check_stack, will_check, Norg_, del_);
+		while (!check_stack.empty())
+		{
+			std::size_t cur_loc = check_stack.top();
+			check_stack.pop();
+			checked[cur_loc] = true;
+			bool added = false;
+			del_.GetPointTetras(cur_loc, point_tetras_temp_);
+			std::size_t const Ntetra = point_tetras_temp_.size();
+			for (std::size_t j = 0; j < Nprocs; ++j)
+			{
+				for (std::size_t i = 0; i < Ntetra; ++i)
+				{
+					sphere.radius = GetRadius(point_tetras_temp_[i]);
+					sphere.center = tetra_centers_[point_tetras_temp_[i]];
+					if (SphereBoxIntersection(sphere, boxes[static_cast<std::size_t>(duplicatedprocs_[j])]))
+					{
+						to_send[j].push_back(cur_loc);
+						added = true;
+						break;
+					}
+				}
+			}
+			vector<std::size_t> intersecting_faces = FindIntersectionsSingle(box_faces, cur_loc, sphere);
+			for (std::size_t j = 0; j < intersecting_faces.size(); ++j)
+			{
+				box_candidates[intersecting_faces[j]].push_back(cur_loc);
+				added = true;
+			}
+			if (added)
+			{
+				GetPointToCheck(cur_loc, checked, point_neigh);
+				std::size_t Nneigh = point_neigh.size();
+				for (std::size_t j = 0; j < Nneigh; ++j)
+					if (point_neigh[j] < Norg_ && !will_check[point_neigh[j]])
+					{
+						check_stack.push(point_neigh[j]);
+						will_check[point_neigh[j]] = true;
+					}
+			}
+		}
+	}
+	// Clean
+	vector<Vector3D> res;
+	for (size_t i = 0; i < Nprocs; ++i)
+	{
+		std::sort(to_send[i].begin(), to_send[i].end());
+		to_send[i] = unique(to_send[i]);
+		vector<size_t> sorted_sent(duplicated_points_[i]);
+		std::sort(sorted_sent.begin(), sorted_sent.end());
+		vector<size_t> temp;
+		for (size_t j = 0; j < to_send[i].size(); ++j)
+			if (!std::binary_search(sorted_sent.begin(), sorted_sent.end(), to_send[i][j]))
+				temp.push_back(to_send[i][j]);
+		to_send[i] = temp;
+		duplicated_points_[i].insert(duplicated_points_[i].end(), temp.begin(), temp.end());
+	}
+	for (size_t i = 0; i < box_candidates.size(); ++i)
+	{
+		std::sort(box_candidates[i].begin(), box_candidates[i].end());
+		box_candidates[i] = unique(box_candidates[i]);
+		for (size_t j = 0; j < box_candidates[i].size(); ++j)
+		{
+			if (!std::binary_search(self_duplicate[i].begin(), self_duplicate[i].end(), box_candidates[i][j]))
+				res.push_back(MirrorPoint(box_faces[i], del_.points_[box_candidates[i][j]]));
+		}
+		self_duplicate[i].insert(self_duplicate[i].end(), box_candidates[i].begin(), box_candidates[i].end());
+		std::sort(self_duplicate[i].begin(), self_duplicate[i].end());
+		self_duplicate[i] = unique(self_duplicate[i]);
+	}
+	// Communicate
+	vector<vector<Vector3D> > toadd = MPI_exchange_data(duplicatedprocs_, to_send, del_.points_);
+	// Add points
+	Nghost_.resize(toadd.size());
+	for (std::size_t i = 0; i < toadd.size(); ++i)
+		for (std::size_t j = 0; j < toadd[i].size(); ++j)
+		{
+			Nghost_[i].push_back(del_.points_.size() + res.size());
 			res.push_back(toadd[i][j]);
 		}
 	return res;
@@ -570,8 +1162,10 @@ vector<vector<std::size_t> > const& Voronoi3D::GetGhostIndeces(void) const
 void Voronoi3D::Build(vector<Vector3D> const & points, Tessellation3D const& tproc)
 {
 	assert(points.size() > 0);
+	if (periodic_)
+		throw UniversalError("Periodic boundaries are only supported in serial builds");
+	double const start_time = MPI_Wtime();
 	// Clear data
-	PointTetras_.clear();
 	R_.clear();
 	tetra_centers_.clear();
 	del_.Clean();
@@ -582,6 +1176,7 @@ void Voronoi3D::Build(vector<Vector3D> const & points, Tessellation3D const& tpr
 	CM_.clear();
 	volume_.clear();
 	area_.clear();
+	face_cm_.clear();
 	Nghost_.clear();
 	duplicatedprocs_.clear();
 	duplicated_points_.clear();
@@ -595,17 +1190,18 @@ void Voronoi3D::Build(vector<Vector3D> const & points, Tessellation3D const& tpr
 	R_.resize(del_.tetras_.size());
 	std::fill(R_.begin(), R_.end(), -1);
 	tetra_centers_.resize(R_.size());
-	bigtet_ = SetPointTetras(PointTetras_, Norg_, del_.tetras_, del_.empty_tetras_);
+	bigtet_ = del_.FindOuterTetra();
 
 	vector<vector<size_t> > self_duplicate;
 	vector<std::pair<std::size_t, std::size_t> > ghost_index = FindIntersections(tproc, false); // intersecting tproc face, point index
 	vector<Vector3D> extra_points = CreateBoundaryPointsMPI(ghost_index, tproc,self_duplicate);
 
+	std::size_t const Nstart = del_.points_.size();
 	del_.BuildExtra(extra_points);
 	R_.resize(del_.tetras_.size());
 	std::fill(R_.begin(), R_.end(), -1);
 	tetra_centers_.resize(R_.size());
-	bigtet_ = SetPointTetras(PointTetras_, Norg_, del_.tetras_, del_.empty_tetras_);
+	bigtet_ = FindGhostTetra(del_, Nstart, bigtet_);
 
 	ghost_index = FindIntersections(tproc, true);
 	extra_points = CreateBoundaryPointsMPI(ghost_index, tproc,self_duplicate);
@@ -620,48 +1216,260 @@ void Voronoi3D::Build(vector<Vector3D> const & points, Tessellation3D const& tpr
 	volume_.resize(Norg_);
 	// Create Voronoi
 	BuildVoronoi();
-	CalcAllCM();
-	for (std::size_t i = 0; i < FaceNeighbors_.size(); ++i)
-		if (BoundaryFace(i))
-			CalcRigidCM(i);
+	CalcAllFaceGeometry();
+	CalcGhostCM();
 	// communicate the ghost CM
 	vector<vector<Vector3D> > incoming = MPI_exchange_data(duplicatedprocs_, duplicated_points_, CM_);
 	// Add the recieved CM
 	for (size_t i = 0; i < incoming.size(); ++i)
 		for (size_t j = 0; j < incoming.at(i).size(); ++j)
 			CM_[Nghost_.at(i).at(j)] = incoming[i][j];
+	build_time_ = MPI_Wtime() - start_time;
 }
-#endif
 
-void Voronoi3D::CalcAllCM(void)
+void Voronoi3D::Build(vector<Vector3D> const & points, HilbertPartition3D const& hproc)
 {
-	size_t Nfaces = FaceNeighbors_.size();
-	boost::array<Vector3D, 4> tetra;
-	for (size_t i = 0; i < Nfaces; ++i)
-	{
-		size_t N0 = FaceNeighbors_[i].first;
-		size_t N1 = FaceNeighbors_[i].second;
-		size_t Npoints = PointsInFace_[i].size();
+	if (periodic_)
+		throw UniversalError("Periodic boundaries are only supported in serial builds");
+	double const start_time = MPI_Wtime();
+	// Clear data
+	R_.clear();
+	tetra_centers_.clear();
+	del_.Clean();
+	// Voronoi Data
+	FacesInCell_.clear();
+	PointsInFace_.clear();
+	FaceNeighbors_.clear();
+	CM_.clear();
+	volume_.clear();
+	area_.clear();
+	face_cm_.clear();
+	Nghost_.clear();
+	duplicatedprocs_.clear();
+	duplicated_points_.clear();
 
-		tetra[0] = tetra_centers_[PointsInFace_[i][0]];
-		for (std::size_t j = 0; j < Npoints - 2; ++j)
+	int rank = 0, wsize = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &wsize);
+	// Send the points to their owners
+	vector<int> owners = hproc.GetOwners(points);
+	vector<Vector3D> new_points;
+	new_points.reserve(points.size());
+	self_index_.clear();
+	sentprocs_.clear();
+	sentpoints_.clear();
+	vector<int> proc_loc(static_cast<std::size_t>(wsize), -1);
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		if (owners[i] == rank)
 		{
-			tetra[1] = tetra_centers_[PointsInFace_[i][j + 1]];
-			tetra[2] = tetra_centers_[PointsInFace_[i][j + 2]];
-			if (N0 < Norg_)
-			{
-				tetra[3] = del_.points_[N0];
-				double vol = GetTetraVolume(tetra);
-				CM_[N0] += std::abs(vol)*GetTetraCM(tetra);
-				volume_[N0] += std::abs(vol);
-			}
-			if (N1 < Norg_)
+			new_points.push_back(points[i]);
+			self_index_.push_back(i);
+			continue;
+		}
+		if (proc_loc[static_cast<std::size_t>(owners[i])] < 0)
+		{
+			proc_loc[static_cast<std::size_t>(owners[i])] = static_cast<int>(sentprocs_.size());
+			sentprocs_.push_back(owners[i]);
+			sentpoints_.push_back(vector<std::size_t>());
+		}
+		sentpoints_[static_cast<std::size_t>(proc_loc[static_cast<std::size_t>(owners[i])])].push_back(i);
+	}
+	AddTalkingProcs(sentprocs_, sentpoints_);
+	vector<vector<Vector3D> > incoming_points = MPI_exchange_data(sentprocs_, sentpoints_, points);
+	for (std::size_t i = 0; i < incoming_points.size(); ++i)
+		new_points.insert(new_points.end(), incoming_points[i].begin(), incoming_points[i].end());
+	Norg_ = new_points.size();
+	assert(Norg_ > 0);
+
+	vector<std::pair<Vector3D, Vector3D> > boxes = GatherBoundingBoxes(new_points, Norg_);
+
+	del_.Build(new_points, ur_, ll_);
+	R_.resize(del_.tetras_.size());
+	std::fill(R_.begin(), R_.end(), -1);
+	tetra_centers_.resize(R_.size());
+	bigtet_ = del_.FindOuterTetra();
+
+	// The processors to exchange ghosts with are the ones whose boxes are reached by one of our circumspheres
+	vector<bool> talks(boxes.size(), false);
+	talks[static_cast<std::size_t>(rank)] = true;
+	Sphere sphere;
+	std::size_t const Ntetra = del_.tetras_.size();
+	for (std::size_t i = 0; i < Ntetra; ++i)
+	{
+		if (del_.empty_tetras_.find(i) != del_.empty_tetras_.end())
+			continue;
+		b_array_4 const& tpoints = del_.tetras_[i].points;
+		if (tpoints[0] >= Norg_ || tpoints[1] >= Norg_ || tpoints[2] >= Norg_ || tpoints[3] >= Norg_)
+			continue;
+		sphere.radius = GetRadius(i);
+		sphere.center = tetra_centers_[i];
+		for (std::size_t j = 0; j < boxes.size(); ++j)
+			if (!talks[j] && SphereBoxIntersection(sphere, boxes[j]))
 			{
-				tetra[3] = del_.points_[N1];
-				double vol = GetTetraVolume(tetra);
-				CM_[N1] += std::abs(vol)*GetTetraCM(tetra);
-				volume_[N1] += std::abs(vol);
+				talks[j] = true;
+				duplicatedprocs_.push_back(static_cast<int>(j));
 			}
+	}
+	duplicated_points_.resize(duplicatedprocs_.size());
+	AddTalkingProcs(duplicatedprocs_, duplicated_points_);
+
+	vector<vector<size_t> > self_duplicate;
+	vector<Vector3D> extra_points = CreateBoundaryPointsHilbert(boxes, true, self_duplicate);
+
+	std::size_t const Nstart = del_.points_.size();
+	del_.BuildExtra(extra_points);
+	R_.resize(del_.tetras_.size());
+	std::fill(R_.begin(), R_.end(), -1);
+	tetra_centers_.resize(R_.size());
+	bigtet_ = FindGhostTetra(del_, Nstart, bigtet_);
+
+	extra_points = CreateBoundaryPointsHilbert(boxes, false, self_duplicate);
+
+	del_.BuildExtra(extra_points);
+	R_.resize(del_.tetras_.size());
+	std::fill(R_.begin(), R_.end(), -1);
+	tetra_centers_.resize(R_.size());
+
+	CM_.resize(del_.points_.size());
+	volume_.resize(Norg_);
+	// Create Voronoi
+	BuildVoronoi();
+	CalcAllFaceGeometry();
+	CalcGhostCM();
+	// communicate the ghost CM
+	vector<vector<Vector3D> > incoming = MPI_exchange_data(duplicatedprocs_, duplicated_points_, CM_);
+	// Add the recieved CM
+	for (size_t i = 0; i < incoming.size(); ++i)
+		for (size_t j = 0; j < incoming.at(i).size(); ++j)
+			CM_[Nghost_.at(i).at(j)] = incoming[i][j];
+	build_time_ = MPI_Wtime() - start_time;
+}
+#endif
+
+void Voronoi3D::CalcAllFaceGeometry(void)
+{
+	std::size_t const Nfaces = FaceNeighbors_.size();
+	area_.resize(Nfaces);
+	face_cm_.resize(Nfaces);
+	std::fill(volume_.begin(), volume_.end(), 0.0);
+	std::fill(CM_.begin(), CM_.begin() + static_cast<long>(Norg_), Vector3D());
+	for (std::size_t i = 0; i < Nfaces; ++i)
+	{
+		area_[i] = FaceAreaCentroid(PointsInFace_[i], tetra_centers_, face_cm_[i]);
+		Vector3D const& centroid = face_cm_[i];
+		// The face is the bisector of its two neighbors, so both pyramids have a height of half their distance
+		std::size_t const N0 = FaceNeighbors_[i].first;
+		std::size_t const N1 = FaceNeighbors_[i].second;
+		double const vol = area_[i] * abs(del_.points_[N1] - del_.points_[N0]) / 6.0;
+		if (N0 < Norg_)
+		{
+			volume_[N0] += vol;
+			CM_[N0] += vol * (0.25 * del_.points_[N0] + 0.75 * centroid);
+		}
+		if (N1 < Norg_)
+		{
+			volume_[N1] += vol;
+			CM_[N1] += vol * (0.25 * del_.points_[N1] + 0.75 * centroid);
+		}
+	}
+	for (std::size_t i = 0; i < Norg_; ++i)
+		if (volume_[i] > 0)
+			CM_[i] = CM_[i] / volume_[i];
+	face_geometry_dirty_ = false;
+	cell_geometry_dirty_ = false;
+}
+
+void Voronoi3D::CalcGhostCM(void)const
+{
+	if (periodic_)
+		CalcPeriodicCM();
+	for (std::size_t i = 0; i < FaceNeighbors_.size(); ++i)
+		if (BoundaryFace(i))
+			CalcRigidCM(i);
+}
+
+void Voronoi3D::CalcFaceGeometry(void)const
+{
+	long const Nfaces = static_cast<long>(FaceNeighbors_.size());
+	area_.resize(FaceNeighbors_.size());
+	face_cm_.resize(FaceNeighbors_.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (long i = 0; i < Nfaces; ++i)
+		area_[static_cast<std::size_t>(i)] = FaceAreaCentroid(PointsInFace_[static_cast<std::size_t>(i)], tetra_centers_,
+			face_cm_[static_cast<std::size_t>(i)]);
+}
+
+void Voronoi3D::CalcCellGeometry(void)const
+{
+	// Every cell sums its own faces, in the same order as the single pass over the faces
+	long const N = static_cast<long>(Norg_);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (long i = 0; i < N; ++i)
+		CalcCellCMVolume(static_cast<std::size_t>(i));
+	CalcGhostCM();
+}
+
+void Voronoi3D::UpdateFaceGeometry(void) const
+{
+	// Accessors may be called from several threads, only the first one to get here calculates. The flag is read and
+	// written atomically, and it is cleared only after the geometry is flushed, so a thread that sees it cleared and
+	// flushes sees the geometry as well
+	bool dirty;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+	dirty = face_geometry_dirty_;
+#ifdef _OPENMP
+#pragma omp flush
+#endif
+	if (!dirty)
+		return;
+#ifdef _OPENMP
+#pragma omp critical(voronoi3d_face_geometry)
+#endif
+	{
+		if (face_geometry_dirty_)
+		{
+			CalcFaceGeometry();
+#ifdef _OPENMP
+#pragma omp flush
+#pragma omp atomic write
+#endif
+			face_geometry_dirty_ = false;
+		}
+	}
+}
+
+void Voronoi3D::UpdateCellGeometry(void) const
+{
+	bool dirty;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+	dirty = cell_geometry_dirty_;
+#ifdef _OPENMP
+#pragma omp flush
+#endif
+	if (!dirty)
+		return;
+	UpdateFaceGeometry();
+#ifdef _OPENMP
+#pragma omp critical(voronoi3d_cell_geometry)
+#endif
+	{
+		if (cell_geometry_dirty_)
+		{
+			CalcCellGeometry();
+#ifdef _OPENMP
+#pragma omp flush
+#pragma omp atomic write
+#endif
+			cell_geometry_dirty_ = false;
 		}
 	}
 }
@@ -669,8 +1477,8 @@ void Voronoi3D::CalcAllCM(void)
 void Voronoi3D::Build(vector<Vector3D> const & points)
 {
 	assert(points.size() > 0);
+	double const start_time = WallTime();
 	// Clear data
-	PointTetras_.clear();
 	R_.clear();
 	tetra_centers_.clear();
 	del_.Clean();
@@ -681,6 +1489,7 @@ void Voronoi3D::Build(vector<Vector3D> const & points)
 	CM_.clear();
 	volume_.clear();
 	area_.clear();
+	face_cm_.clear();
 	Norg_ = points.size();
 	duplicatedprocs_.clear();
 	duplicated_points_.clear();
@@ -690,46 +1499,48 @@ void Voronoi3D::Build(vector<Vector3D> const & points)
 	R_.resize(del_.tetras_.size());
 	std::fill(R_.begin(), R_.end(), -1);
 	tetra_centers_.resize(R_.size());
-	bigtet_ = SetPointTetras(PointTetras_, Norg_, del_.tetras_, del_.empty_tetras_);
+	bigtet_ = del_.FindOuterTetra();
 
-	vector<std::pair<std::size_t, std::size_t> > ghost_index = SerialFindIntersections();
-	vector<Vector3D> extra_points = CreateBoundaryPoints(ghost_index);
+	if (periodic_)
+		CreatePeriodicPoints();
+	else
+	{
+		vector<std::pair<std::size_t, std::size_t> > ghost_index = SerialFindIntersections();
+		vector<std::size_t> seeds;
+		vector<Vector3D> extra_points = CreateBoundaryPoints(ghost_index, seeds);
 
-	del_.BuildExtra(extra_points);
+		del_.BuildExtra(extra_points, seeds);
 
-	R_.resize(del_.tetras_.size());
-	std::fill(R_.begin(), R_.end(), -1);
-	tetra_centers_.resize(R_.size());
+		R_.resize(del_.tetras_.size());
+		std::fill(R_.begin(), R_.end(), -1);
+		tetra_centers_.resize(R_.size());
+	}
 
 	CM_.resize(del_.points_.size());
 	volume_.resize(Norg_, 0);
 	// Create Voronoi
 	BuildVoronoi();
-	CalcAllCM();
-	for (std::size_t i = 0; i < FaceNeighbors_.size(); ++i)
-		if (BoundaryFace(i))
-			CalcRigidCM(i);
+	face_geometry_dirty_ = lazy_;
+	cell_geometry_dirty_ = lazy_;
+	if (!lazy_)
+	{
+		CalcAllFaceGeometry();
+		CalcGhostCM();
+	}
+	build_time_ = WallTime() - start_time;
 }
 
 void Voronoi3D::BuildVoronoi(void)
 {
 	FacesInCell_.resize(Norg_);
-	PointTetras_.resize(Norg_);
 	FaceNeighbors_.reserve(Norg_ * 10);
 	PointsInFace_.reserve(Norg_ * 10);
 	for (size_t i = 0; i < Norg_; ++i)
-	{
 		FacesInCell_[i].reserve(20);
-		PointTetras_[i].reserve(20);
-	}
 	vector<size_t> temp, temp2;
 	// Build all voronoi points
 	std::size_t Ntetra = del_.tetras_.size();
-	for (size_t i = 0; i < Ntetra; ++i)
-		if (del_.empty_tetras_.find(i) == del_.empty_tetras_.end())
-		{
-			CalcTetraRadiusCenter(i);
-		}
+	CalcAllTetraRadiusCenter();
 	// Organize the faces and assign them to cells
 	for (size_t i = 0; i < Ntetra; ++i)
 	{
@@ -777,13 +1588,31 @@ void Voronoi3D::BuildVoronoi(void)
 							FacesInCell_[N1].push_back(PointsInFace_.size() - 1);
 						// Make faces right handed
 						MakeRightHandFace(PointsInFace_.back(), del_.points_[N0], tetra_centers_, temp);
-						area_.push_back(CalcFaceArea(PointsInFace_.back(), tetra_centers_));
 					}
 				}
 			}
 		}
 	}
+	BuildNeighborList();
+}
 
+void Voronoi3D::BuildNeighborList(void)
+{
+	// The neighbors of all of the cells in one array, in the order of the faces of each cell
+	neighbor_offsets_.resize(Norg_ + 1);
+	neighbor_offsets_[0] = 0;
+	for (size_t i = 0; i < Norg_; ++i)
+		neighbor_offsets_[i + 1] = neighbor_offsets_[i] + FacesInCell_[i].size();
+	neighbor_list_.resize(neighbor_offsets_[Norg_]);
+	for (size_t i = 0; i < Norg_; ++i)
+	{
+		size_t const Nfaces = FacesInCell_[i].size();
+		for (size_t j = 0; j < Nfaces; ++j)
+		{
+			std::pair<size_t, size_t> const& neighbors = FaceNeighbors_[FacesInCell_[i][j]];
+			neighbor_list_[neighbor_offsets_[i] + j] = neighbors.first == i ? neighbors.second : neighbors.first;
+		}
+	}
 }
 
 double Voronoi3D::GetRadius(std::size_t index)
@@ -795,24 +1624,26 @@ double Voronoi3D::GetRadius(std::size_t index)
 
 double Voronoi3D::GetMaxRadius(std::size_t index)
 {
-	std::size_t N = PointTetras_[index].size();
+	del_.GetPointTetras(index, point_tetras_temp_);
+	std::size_t N = point_tetras_temp_.size();
 	double res = 0;
 	for (std::size_t i = 0; i < N; ++i)
-		res = std::max(res, GetRadius(PointTetras_[index][i]));
+		res = std::max(res, GetRadius(point_tetras_temp_[i]));
 	return 2 * res;
 }
 
 vector<std::size_t>  Voronoi3D::FindIntersectionsSingle(vector<Face> const& box, std::size_t point, Sphere &sphere)
 {
-	std::size_t N = PointTetras_[point].size();
+	del_.GetPointTetras(point, point_tetras_temp_);
+	std::size_t N = point_tetras_temp_.size();
 	vector<std::size_t> res;
 	res.reserve(4);
 	for (std::size_t j = 0; j < box.size(); ++j)
 	{
 		for (std::size_t i = 0; i < N; ++i)
 		{
-			sphere.radius = GetRadius(PointTetras_[point][i]);
-			sphere.center = tetra_centers_[PointTetras_[point][i]];
+			sphere.radius = GetRadius(point_tetras_temp_[i]);
+			sphere.center = tetra_centers_[point_tetras_temp_[i]];
 			if (FaceSphereIntersections(box[j], sphere))
 			{
 				res.push_back(j);
@@ -828,26 +1659,25 @@ vector<std::size_t>  Voronoi3D::FindIntersectionsRecursive(Tessellation3D const&
 {
 	vector<std::size_t> res;
 	std::size_t N = tproc.GetPointNo();
-	std::size_t Nfaces = tproc.GetTotalFacesNumber();
-	vector<bool> visited(Nfaces, false);
+	++visit_epoch_;
 	std::stack<std::size_t> to_check;
-	std::size_t Ntetra = PointTetras_[point].size();
-	vector<std::size_t> faces = tproc.GetCellFaces(rank);
-	for (std::size_t i = 0; i < faces.size(); ++i)
-		to_check.push(faces[i]);
+	del_.GetPointTetras(point, point_tetras_temp_);
+	std::size_t Ntetra = point_tetras_temp_.size();
+	for (std::size_t i = 0; i < rank_faces_.size(); ++i)
+		to_check.push(rank_faces_[i]);
 	while (!to_check.empty())
 	{
 		std::size_t cur = to_check.top();
 		to_check.pop();
-		if (visited[cur])
+		if (visit_stamp_[cur] == visit_epoch_)
 			continue;
-		visited[cur] = true;
+		visit_stamp_[cur] = visit_epoch_;
 		Face f(VectorValues(tproc.GetFacePoints(), tproc.GetPointsInFace(cur)), tproc.GetFaceNeighbors(cur).first,
 			tproc.GetFaceNeighbors(cur).second);
 		for (std::size_t j = 0; j < Ntetra; ++j)
 		{
-			sphere.radius = GetRadius(PointTetras_[point][j]);
-			sphere.center = tetra_centers_[PointTetras_[point][j]];
+			sphere.radius = GetRadius(point_tetras_temp_[j]);
+			sphere.center = tetra_centers_[point_tetras_temp_[j]];
 			if (FaceSphereIntersections(f, sphere))
 			{
 				res.push_back(cur);
@@ -857,14 +1687,14 @@ vector<std::size_t>  Voronoi3D::FindIntersectionsRecursive(Tessellation3D const&
 					{
 						vector<std::size_t> const& faces_temp = tproc.GetCellFaces(f.neighbors.first);
 						for (std::size_t i = 0; i < faces_temp.size(); ++i)
-							if (!visited[faces_temp[i]])
+							if (visit_stamp_[faces_temp[i]] != visit_epoch_)
 								to_check.push(faces_temp[i]);
 					}
 					if (f.neighbors.second < N && f.neighbors.second != rank)
 					{
 						vector<std::size_t> const& faces_temp = tproc.GetCellFaces(f.neighbors.second);
 						for (std::size_t i = 0; i < faces_temp.size(); ++i)
-							if (!visited[faces_temp[i]])
+							if (visit_stamp_[faces_temp[i]] != visit_epoch_)
 								to_check.push(faces_temp[i]);
 					}
 				}
@@ -880,12 +1710,13 @@ vector<std::size_t>  Voronoi3D::FindIntersectionsRecursive(Tessellation3D const&
 void Voronoi3D::GetPointToCheck(std::size_t point, vector<bool> const& checked, vector<std::size_t> &res)
 {
 	res.clear();
-	std::size_t ntetra = PointTetras_[point].size();
+	del_.GetPointTetras(point, point_tetras_temp_);
+	std::size_t ntetra = point_tetras_temp_.size();
 	for (std::size_t i = 0; i < ntetra; ++i)
 	{
 		for (std::size_t j = 0; j < 4; ++j)
-			if (del_.tetras_[PointTetras_[point][i]].points[j] < Norg_ && !checked[del_.tetras_[PointTetras_[point][i]].points[j]])
-				res.push_back(del_.tetras_[PointTetras_[point][i]].points[j]);
+			if (del_.tetras_[point_tetras_temp_[i]].points[j] < Norg_ && !checked[del_.tetras_[point_tetras_temp_[i]].points[j]])
+				res.push_back(del_.tetras_[point_tetras_temp_[i]].points[j]);
 	}
 	std::sort(res.begin(), res.end());
 	res = unique(res);
@@ -912,6 +1743,10 @@ vector<std::pair<std::size_t, std::size_t> > Voronoi3D::FindIntersections(Tessel
 	Sphere sphere;
 	vector<bool> checked(Norg_, false), will_check(Norg_, false);
 	FirstCheckList(check_stack, will_check, Norg_, del_);
+	// The visited marks are cleared once per search and not once per point
+	visit_stamp_.assign(tproc.GetTotalFacesNumber(), 0);
+	visit_epoch_ = 0;
+	rank_faces_ = tproc.GetCellFaces(static_cast<std::size_t>(rank));
 	size_t cur_loc;
 	while (!check_stack.empty())
 	{
@@ -986,33 +1821,135 @@ vector<std::pair<std::size_t, std::size_t> > Voronoi3D::SerialFindIntersections(
 
 double Voronoi3D::CalcTetraRadiusCenter(std::size_t index)
 {
-	Vector3D v2(del_.points_[del_.tetras_[index].points[1]] - del_.points_[del_.tetras_[index].points[0]]);
-	Vector3D v3(del_.points_[del_.tetras_[index].points[2]] - del_.points_[del_.tetras_[index].points[0]]);
-	Vector3D v4(del_.points_[del_.tetras_[index].points[3]] - del_.points_[del_.tetras_[index].points[0]]);
-	Mat33<double> m_a(v2.x, v2.y, v2.z,
-		v3.x, v3.y, v3.z,
-		v4.x, v4.y, v4.z);
-	double a = m_a.determinant();
-
-	Mat33<double> m_Dx(ScalarProd(v2, v2), v2.y, v2.z,
-		ScalarProd(v3, v3), v3.y, v3.z,
-		ScalarProd(v4, v4), v4.y, v4.z);
-	double Dx = m_Dx.determinant();
-
-	Mat33<double> m_Dy(ScalarProd(v2, v2), v2.x, v2.z,
-		ScalarProd(v3, v3), v3.x, v3.z,
-		ScalarProd(v4, v4), v4.x, v4.z);
-	double Dy = -m_Dy.determinant();
-
-	Mat33<double> m_Dz(ScalarProd(v2, v2), v2.x, v2.y,
-		ScalarProd(v3, v3), v3.x, v3.y,
-		ScalarProd(v4, v4), v4.x, v4.y);
-	double Dz = m_Dz.determinant();
+	Tetrahedron const& tet = del_.tetras_[index];
+	Vector3D const& p0 = del_.points_[tet.points[0]];
+	Vector3D const& p1 = del_.points_[tet.points[1]];
+	Vector3D const& p2 = del_.points_[tet.points[2]];
+	Vector3D const& p3 = del_.points_[tet.points[3]];
+	return TetraRadiusCenter(p0, p1, p2, p3, tetra_centers_[index]);
+}
 
-	double c = 0;
+void Voronoi3D::GetCell(std::size_t point, VoronoiCell &cell) const
+{
+	// Only the tetras around the point are used and nothing is cached, so cells can be calculated in parallel
+	vector<std::size_t> tetras;
+	del_.GetPointTetrasThreadSafe(point, tetras);
+	std::size_t const Ntetra = tetras.size();
+	cell.vertices.resize(Ntetra);
+	cell.neighbors.clear();
+	for (std::size_t i = 0; i < Ntetra; ++i)
+	{
+		Tetrahedron const& tet = del_.tetras_[tetras[i]];
+		TetraRadiusCenter(del_.points_[tet.points[0]], del_.points_[tet.points[1]], del_.points_[tet.points[2]],
+			del_.points_[tet.points[3]], cell.vertices[i]);
+		for (std::size_t j = 0; j < 4; ++j)
+			if (tet.points[j] != point)
+				cell.neighbors.push_back(tet.points[j]);
+	}
+	std::sort(cell.neighbors.begin(), cell.neighbors.end());
+	cell.neighbors = unique(cell.neighbors);
+	std::size_t const Nneigh = cell.neighbors.size();
+	cell.faces.resize(Nneigh);
+	cell.areas.resize(Nneigh);
+	cell.face_cm.resize(Nneigh);
+	cell.volume = 0;
+	cell.CM = Vector3D();
+	Vector3D const& p = del_.points_[point];
+	vector<std::size_t> loop, temp;
+	std::size_t Nfaces = 0;
+	for (std::size_t i = 0; i < Nneigh; ++i)
+	{
+		// Go around the edge between the point and its neighbor, the vertices are given by their place in tetras
+		std::size_t const neigh = cell.neighbors[i];
+		std::size_t first = 0;
+		while (std::find(del_.tetras_[tetras[first]].points.begin(), del_.tetras_[tetras[first]].points.end(), neigh) ==
+			del_.tetras_[tetras[first]].points.end())
+			++first;
+		std::size_t const start = tetras[first];
+		loop.clear();
+		loop.push_back(first);
+		std::size_t last = start;
+		std::size_t cur = NextLoopTetra(del_.tetras_[start], start, point, neigh);
+		while (cur != start)
+		{
+			loop.push_back(static_cast<std::size_t>(std::find(tetras.begin(), tetras.end(), cur) - tetras.begin()));
+			std::size_t const next = NextLoopTetra(del_.tetras_[cur], last, point, neigh);
+			last = cur;
+			cur = next;
+		}
+		double const dist = abs(del_.points_[neigh] - p);
+		CleanDuplicates(loop, cell.vertices, cell.faces[Nfaces], dist);
+		if (cell.faces[Nfaces].size() < 3)
+			continue;
+		MakeRightHandFace(cell.faces[Nfaces], p, cell.vertices, temp);
+		cell.neighbors[Nfaces] = neigh;
+		cell.areas[Nfaces] = FaceAreaCentroid(cell.faces[Nfaces], cell.vertices, cell.face_cm[Nfaces]);
+		double const vol = cell.areas[Nfaces] * dist / 6.0;
+		cell.volume += vol;
+		cell.CM += vol * (0.25 * p + 0.75 * cell.face_cm[Nfaces]);
+		++Nfaces;
+	}
+	cell.faces.resize(Nfaces);
+	cell.neighbors.resize(Nfaces);
+	cell.areas.resize(Nfaces);
+	cell.face_cm.resize(Nfaces);
+	if (cell.volume > 0)
+		cell.CM = cell.CM / cell.volume;
+}
 
-	tetra_centers_[index] = Vector3D(Dx / (2 * a), Dy / (2 * a), Dz / (2 * a)) + del_.points_[del_.tetras_[index].points[0]];
-	return 0.5*sqrt(Dx*Dx + Dy*Dy + Dz*Dz - 4 * a*c) / std::abs(a);
+void Voronoi3D::CalcAllTetraRadiusCenter(void)
+{
+	std::size_t const Ntetra = del_.tetras_.size();
+	R_.resize(Ntetra);
+	tetra_centers_.resize(Ntetra);
+	long const Nblocks = static_cast<long>((Ntetra + circumcenter_block - 1) / circumcenter_block);
+	// The free tetras still point to valid points, so they are calculated as well and the kernel has no branches
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (long b = 0; b < Nblocks; ++b)
+	{
+		double x[3][circumcenter_block], y[3][circumcenter_block], z[3][circumcenter_block];
+		double ox[circumcenter_block], oy[circumcenter_block], oz[circumcenter_block];
+		double cx[circumcenter_block], cy[circumcenter_block], cz[circumcenter_block], R[circumcenter_block];
+		bool sliver[circumcenter_block];
+		std::size_t const start = static_cast<std::size_t>(b) * circumcenter_block;
+		std::size_t const N = std::min(circumcenter_block, Ntetra - start);
+		// Gather the edges into struct of arrays
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			Tetrahedron const& tet = del_.tetras_[start + i];
+			Vector3D const& p0 = del_.points_[tet.points[0]];
+			ox[i] = p0.x;
+			oy[i] = p0.y;
+			oz[i] = p0.z;
+			for (std::size_t j = 0; j < 3; ++j)
+			{
+				Vector3D const& p = del_.points_[tet.points[j + 1]];
+				x[j][i] = p.x - p0.x;
+				y[j][i] = p.y - p0.y;
+				z[j][i] = p.z - p0.z;
+			}
+		}
+		for (std::size_t i = 0; i < N; ++i)
+			R[i] = TetraCircumcenter(x[0][i], y[0][i], z[0][i], x[1][i], y[1][i], z[1][i], x[2][i], y[2][i], z[2][i],
+				cx[i], cy[i], cz[i], sliver[i]);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			tetra_centers_[start + i] = Vector3D(cx[i] + ox[i], cy[i] + oy[i], cz[i] + oz[i]);
+			R_[start + i] = R[i];
+		}
+		// Redo the slivers with the accurate determinant, they are rare so this is outside of the kernel
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (sliver[i])
+			{
+				Tetrahedron const& tet = del_.tetras_[start + i];
+				R_[start + i] = SliverCircumcenter(del_.points_[tet.points[0]], del_.points_[tet.points[1]],
+					del_.points_[tet.points[2]], del_.points_[tet.points[3]], tetra_centers_[start + i]);
+			}
+		}
+	}
 }
 
 Vector3D Voronoi3D::GetTetraCM(boost::array<Vector3D, 4> const& points)const
@@ -1025,37 +1962,27 @@ Vector3D Voronoi3D::GetTetraCM(boost::array<Vector3D, 4> const& points)const
 
 double Voronoi3D::GetTetraVolume(boost::array<Vector3D, 4> const& points)const
 {
-	Mat33<double> mat(points[1].x - points[0].x, points[1].y - points[0].y, points[1].z - points[0].z,
+	double const det = Det33(points[1].x - points[0].x, points[1].y - points[0].y, points[1].z - points[0].z,
 		points[2].x - points[0].x, points[2].y - points[0].y, points[2].z - points[0].z,
 		points[3].x - points[0].x, points[3].y - points[0].y, points[3].z - points[0].z);
-	double det = mat.determinant();
 	return det / 6.0;
 }
 
-void Voronoi3D::CalcCellCMVolume(std::size_t index)
+void Voronoi3D::CalcCellCMVolume(std::size_t index)const
 {
 	volume_[index] = 0;
 	CM_[index] = Vector3D();
 	std::size_t Nfaces = FacesInCell_[index].size();
-	boost::array<Vector3D, 4> tetra;
-	tetra[3] = del_.points_[index];
 	for (std::size_t i = 0; i < Nfaces; ++i)
 	{
 		std::size_t face = FacesInCell_[index][i];
-		std::size_t Npoints = PointsInFace_[face].size();
-		tetra[0] = tetra_centers_[PointsInFace_[face][0]];
-		double fvol = 0;
-		for (std::size_t j = 0; j < Npoints - 2; ++j)
-		{
-			tetra[1] = tetra_centers_[PointsInFace_[face][j + 1]];
-			tetra[2] = tetra_centers_[PointsInFace_[face][j + 2]];
-			double vol = GetTetraVolume(tetra);
-			fvol += std::abs(vol);
-			CM_[index] += std::abs(vol)*GetTetraCM(tetra);
-		}
-		volume_[index] += fvol;
+		double vol = area_[face] * abs(del_.points_[FaceNeighbors_[face].first] -
+			del_.points_[FaceNeighbors_[face].second]) / 6.0;
+		volume_[index] += vol;
+		CM_[index] += vol * (0.25 * del_.points_[index] + 0.75 * face_cm_[face]);
 	}
-	CM_[index] = CM_[index] / volume_[index];
+	if (volume_[index] > 0)
+		CM_[index] = CM_[index] / volume_[index];
 }
 
 namespace
@@ -1120,6 +2047,125 @@ void Voronoi3D::output(std::string const& filename)const
 	file_handle.close();
 }
 
+void Voronoi3D::WriteCheckpoint(std::string const& filename)const
+{
+	std::ofstream fh(filename.c_str(), std::ios::binary);
+	if (!fh.good())
+		throw UniversalError("Can't open file " + filename);
+	del_.WriteCheckpoint(fh);
+	boost::uint64_t const header[3] = { checkpoint_magic, checkpoint_version, periodic_ ? 1U : 0U };
+	fh.write(reinterpret_cast<const char*>(header), sizeof(header));
+	double box[6] = { ll_.x, ll_.y, ll_.z, ur_.x, ur_.y, ur_.z };
+	fh.write(reinterpret_cast<const char*>(box), sizeof(box));
+	// Processor bookkeeping, empty in serial runs
+	WriteIndeces(fh, vector<vector<std::size_t> >(1, self_index_));
+	WriteIndeces(fh, vector<vector<std::size_t> >(1, vector<std::size_t>(sentprocs_.begin(), sentprocs_.end())));
+	WriteIndeces(fh, sentpoints_);
+	WriteIndeces(fh, vector<vector<std::size_t> >(1, vector<std::size_t>(duplicatedprocs_.begin(),
+		duplicatedprocs_.end())));
+	WriteIndeces(fh, duplicated_points_);
+	WriteIndeces(fh, Nghost_);
+	if (periodic_)
+		WriteIndeces(fh, vector<vector<std::size_t> >(1, periodic_sources_));
+	if (!fh.good())
+		throw UniversalError("Failed writing Voronoi3D checkpoint " + filename);
+	fh.close();
+}
+
+void Voronoi3D::BuildFromCheckpoint(std::string const& filename)
+{
+#ifdef RICH_MPI
+	double const start_time = MPI_Wtime();
+#else
+	double const start_time = WallTime();
+#endif
+	// Clear data
+	R_.clear();
+	tetra_centers_.clear();
+	del_.Clean();
+	// Voronoi Data
+	FacesInCell_.clear();
+	PointsInFace_.clear();
+	FaceNeighbors_.clear();
+	CM_.clear();
+	volume_.clear();
+	area_.clear();
+	face_cm_.clear();
+
+	std::ifstream fh(filename.c_str(), std::ios::binary);
+	if (!fh.good())
+		throw UniversalError("Can't open file " + filename);
+	del_.ReadCheckpoint(fh);
+	boost::uint64_t header[3] = { 0, 0, 0 };
+	fh.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!fh.good() || header[0] != checkpoint_magic)
+		throw UniversalError("Not a Voronoi3D checkpoint, or one written before the Voronoi3D section had a header " + filename);
+	if (header[1] != checkpoint_version)
+	{
+		UniversalError eo("Unsupported Voronoi3D checkpoint version");
+		eo.AddEntry("Version", static_cast<double>(header[1]));
+		throw eo;
+	}
+	if ((header[2] != 0) != periodic_)
+	{
+		UniversalError eo("Voronoi3D checkpoint periodicity does not match the tessellation");
+		eo.AddEntry("Checkpoint periodic", static_cast<double>(header[2]));
+		eo.AddEntry("Tessellation periodic", periodic_ ? 1.0 : 0.0);
+		throw eo;
+	}
+	double box[6];
+	fh.read(reinterpret_cast<char*>(box), sizeof(box));
+	ll_ = Vector3D(box[0], box[1], box[2]);
+	ur_ = Vector3D(box[3], box[4], box[5]);
+	vector<vector<std::size_t> > temp;
+	ReadIndeces(fh, temp);
+	self_index_ = temp.at(0);
+	ReadIndeces(fh, temp);
+	sentprocs_.assign(temp.at(0).begin(), temp.at(0).end());
+	ReadIndeces(fh, sentpoints_);
+	ReadIndeces(fh, temp);
+	duplicatedprocs_.assign(temp.at(0).begin(), temp.at(0).end());
+	ReadIndeces(fh, duplicated_points_);
+	ReadIndeces(fh, Nghost_);
+	if (periodic_)
+	{
+		ReadIndeces(fh, temp);
+		periodic_sources_ = temp.at(0);
+	}
+	fh.close();
+	Norg_ = del_.Norg_;
+
+	R_.resize(del_.tetras_.size());
+	std::fill(R_.begin(), R_.end(), -1);
+	tetra_centers_.resize(R_.size());
+	bigtet_ = del_.FindOuterTetra();
+
+	CM_.resize(del_.points_.size());
+	volume_.resize(Norg_, 0);
+	// Create Voronoi
+	BuildVoronoi();
+#ifdef RICH_MPI
+	CalcAllFaceGeometry();
+	CalcGhostCM();
+	// communicate the ghost CM
+	vector<vector<Vector3D> > incoming = MPI_exchange_data(duplicatedprocs_, duplicated_points_, CM_);
+	// Add the recieved CM
+	for (size_t i = 0; i < incoming.size(); ++i)
+		for (size_t j = 0; j < incoming.at(i).size(); ++j)
+			CM_[Nghost_.at(i).at(j)] = incoming[i][j];
+	build_time_ = MPI_Wtime() - start_time;
+#else
+	face_geometry_dirty_ = lazy_;
+	cell_geometry_dirty_ = lazy_;
+	if (!lazy_)
+	{
+		CalcAllFaceGeometry();
+		CalcGhostCM();
+	}
+	build_time_ = WallTime() - start_time;
+#endif
+}
+
 std::size_t Voronoi3D::GetPointNo(void) const
 {
 	return Norg_;
@@ -1132,11 +2178,13 @@ Vector3D Voronoi3D::GetMeshPoint(std::size_t index) const
 
 double Voronoi3D::GetArea(std::size_t index) const
 {
+	UpdateFaceGeometry();
 	return area_[index];
 }
 
 Vector3D const& Voronoi3D::GetCellCM(std::size_t index) const
 {
+	UpdateCellGeometry();
 	return CM_[index];
 }
 
@@ -1147,11 +2195,13 @@ std::size_t Voronoi3D::GetTotalFacesNumber(void) const
 
 double Voronoi3D::GetWidth(std::size_t index) const
 {
+	UpdateCellGeometry();
 	return pow(3 * volume_[index] * 0.25 / M_PI, 0.333333333);
 }
 
 double Voronoi3D::GetVolume(std::size_t index) const
 {
+	UpdateCellGeometry();
 	return volume_[index];
 }
 
@@ -1167,15 +2217,14 @@ vector<Vector3D>& Voronoi3D::GetMeshPoints(void)
 
 vector<std::size_t> Voronoi3D::GetNeighbors(std::size_t index)const
 {
-	std::size_t N = FacesInCell_[index].size();
-	vector<std::size_t> res(N);
-	for (std::size_t i = 0; i < N; ++i)
-	{
-		std::size_t face = FacesInCell_[index][i];
-		res[i] = FaceNeighbors_[face].first == index ? FaceNeighbors_[face].second :
-			FaceNeighbors_[face].first;
-	}
-	return res;
+	std::pair<NeighborIterator, NeighborIterator> const range = GetNeighborRange(index);
+	return vector<std::size_t>(range.first, range.second);
+}
+
+std::pair<Tessellation3D::NeighborIterator, Tessellation3D::NeighborIterator> Voronoi3D::GetNeighborRange(std::size_t index)const
+{
+	return std::pair<NeighborIterator, NeighborIterator>(neighbor_list_.begin() + static_cast<long>(neighbor_offsets_[index]),
+		neighbor_list_.begin() + static_cast<long>(neighbor_offsets_[index + 1]));
 }
 
 
@@ -1197,6 +2246,9 @@ bool Voronoi3D::NearBoundary(std::size_t index) const
 
 bool Voronoi3D::BoundaryFace(std::size_t index) const
 {
+	// Periodic faces are connected to the translated copy of a real cell
+	if (periodic_)
+		return false;
 	if (FaceNeighbors_[index].first >= Norg_ || FaceNeighbors_[index].second >= Norg_)
 	{
 #ifdef RICH_MPI
@@ -1227,27 +2279,62 @@ std::size_t Voronoi3D::GetTotalPointNumber(void)const
 
 vector<Vector3D>& Voronoi3D::GetAllCM(void)
 {
+	UpdateCellGeometry();
 	return CM_;
 }
 
+vector<Vector3D> const& Voronoi3D::GetAllCM(void)const
+{
+	UpdateCellGeometry();
+	return CM_;
+}
+
+vector<double> const& Voronoi3D::GetAllAreas(void)const
+{
+	UpdateFaceGeometry();
+	return area_;
+}
+
+vector<double> const& Voronoi3D::GetAllVolumes(void)const
+{
+	UpdateCellGeometry();
+	return volume_;
+}
+
+vector<std::pair<std::size_t, std::size_t> > const& Voronoi3D::GetAllFaceNeighbors(void)const
+{
+	return FaceNeighbors_;
+}
+
+void Voronoi3D::GetAllNormals(vector<Vector3D> &normals)const
+{
+	long const Nfaces = static_cast<long>(FaceNeighbors_.size());
+	normals.resize(FaceNeighbors_.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (long i = 0; i < Nfaces; ++i)
+	{
+		std::pair<std::size_t, std::size_t> const& neighbors = FaceNeighbors_[static_cast<std::size_t>(i)];
+		normals[static_cast<std::size_t>(i)] = del_.points_[neighbors.second] - del_.points_[neighbors.first];
+	}
+}
+
 void Voronoi3D::GetNeighborNeighbors(vector<std::size_t> &result, std::size_t point)const
 {
-	result.clear();
-	result.reserve(70);
-	vector<std::size_t> neigh = GetNeighbors(point);
-	result = neigh;
-	std::size_t N = neigh.size();
-	vector<std::size_t> temp;
-	for (std::size_t i = 0; i < N; ++i)
+	// Reads the neighbor array directly and keeps the memory of result, so nothing is allocated once result is large enough
+	std::pair<NeighborIterator, NeighborIterator> const range = GetNeighborRange(point);
+	result.assign(range.first, range.second);
+	for (NeighborIterator it = range.first; it != range.second; ++it)
 	{
-		if (neigh[i] < Norg_)
+		if (*it < Norg_)
 		{
-			temp = GetNeighbors(neigh[i]);
-			result.insert(result.end(), temp.begin(), temp.end());
+			std::pair<NeighborIterator, NeighborIterator> const second = GetNeighborRange(*it);
+			result.insert(result.end(), second.first, second.second);
 		}
 	}
 	sort(result.begin(), result.end());
-	result = unique(result);
+	result.erase(std::unique(result.begin(), result.end()), result.end());
 }
 
 Vector3D Voronoi3D::Normal(std::size_t faceindex)const
@@ -1262,27 +2349,33 @@ bool Voronoi3D::IsGhostPoint(std::size_t index)const
 
 Vector3D Voronoi3D::FaceCM(std::size_t index)const
 {
-	std::size_t N = PointsInFace_[index].size();
-	Vector3D res = tetra_centers_[PointsInFace_[index][0]];
-	for (std::size_t i = 1; i < N; ++i)
-		res += tetra_centers_[PointsInFace_[index][i]];
-	return res / static_cast<double>(N);
+	UpdateFaceGeometry();
+	return face_cm_[index];
 }
 
 Vector3D Voronoi3D::CalcFaceVelocity(std::size_t index, Vector3D const& v0, Vector3D const& v1)const
 {
-	std::size_t p0 = FaceNeighbors_[index].first;
-	std::size_t p1 = FaceNeighbors_[index].second;
-	Vector3D r0 = GetMeshPoint(p0);
-	Vector3D r1 = GetMeshPoint(p1);
-	Vector3D r_diff = r1 - r0;
-	double abs_r_diff = abs(r_diff);
-
-	Vector3D f = FaceCM(index);
+	UpdateFaceGeometry();
+	return FaceVelocity(del_.points_[FaceNeighbors_[index].first], del_.points_[FaceNeighbors_[index].second],
+		face_cm_[index], v0, v1);
+}
 
-	Vector3D delta_w = ScalarProd((v0 - v1), (f - (r1 + r0) / 2)) * r_diff / (abs_r_diff * abs_r_diff);
-	Vector3D w = (v0 + v1) / 2 + delta_w;
-	return w;
+void Voronoi3D::CalcAllFaceVelocities(vector<Vector3D> const& velocities, vector<Vector3D> &face_velocities)const
+{
+	UpdateFaceGeometry();
+	long const Nfaces = static_cast<long>(FaceNeighbors_.size());
+	face_velocities.resize(FaceNeighbors_.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (long i = 0; i < Nfaces; ++i)
+	{
+		std::size_t const face = static_cast<std::size_t>(i);
+		std::size_t const N0 = FaceNeighbors_[face].first;
+		std::size_t const N1 = FaceNeighbors_[face].second;
+		face_velocities[face] = FaceVelocity(del_.points_[N0], del_.points_[N1], face_cm_[face], velocities[N0],
+			velocities[N1]);
+	}
 }
 
 vector<Vector3D>const& Voronoi3D::GetFacePoints(void) const
@@ -1319,3 +2412,13 @@ vector<std::size_t> const& Voronoi3D::GetSelfIndex(void) const
 {
 	return self_index_;
 }
+
+double Voronoi3D::GetBuildTime(void) const
+{
+	return build_time_;
+}
+
+std::pair<Vector3D, Vector3D> Voronoi3D::GetBoxCoordinates(void) const
+{
+	return std::pair<Vector3D, Vector3D>(ll_, ur_);
+}
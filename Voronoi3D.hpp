@@ -18,16 +18,33 @@
 
 #ifdef RICH_MPI
 #include "mpi_commands.hpp"
+#include "HilbertPartition3D.hpp"
 #endif
 
 typedef boost::array<std::size_t, 4> b_array_4;
 typedef boost::array<std::size_t, 3> b_array_3;
 
+//! \brief The geometry of a single Voronoi cell
+struct VoronoiCell
+{
+	vector<Vector3D> vertices; // The circumcenters of the tetras around the point
+	vector<vector<std::size_t> > faces; // The vertices of each face, right handed with regard to the point
+	vector<std::size_t> neighbors; // The point on the other side of each face
+	vector<double> areas;
+	vector<Vector3D> face_cm; // The area weighted centroid of each face
+	double volume;
+	Vector3D CM;
+};
+
 class Voronoi3D : public Tessellation3D
 {
 private:
 	Vector3D ll_, ur_;
 	std::size_t Norg_, bigtet_;
+	bool periodic_;
+	// In lazy mode the face and cell geometry are calculated on their first access, the flags mark what is not calculated yet
+	bool lazy_;
+	mutable bool face_geometry_dirty_, cell_geometry_dirty_;
 
 	std::set<int> set_temp_;
 	std::stack<int> stack_temp_;
@@ -41,50 +58,111 @@ private:
 	vector<std::size_t> FindIntersectionsRecursive(Tessellation3D const& tproc, std::size_t rank, std::size_t point, Sphere &sphere, bool recursive);
 	std::size_t GetFirstPointToCheck(void)const;
 	void GetPointToCheck(std::size_t point, vector<bool> const& checked, vector<std::size_t> &res);
-	void CalcRigidCM(std::size_t face_index);
+	void CalcRigidCM(std::size_t face_index)const;
 	Vector3D GetTetraCM(boost::array<Vector3D, 4> const& points)const;
 	double GetTetraVolume(boost::array<Vector3D, 4> const& points)const;
-	void CalcCellCMVolume(std::size_t index);
+	void CalcCellCMVolume(std::size_t index)const;
 	double GetRadius(std::size_t index);
 	double GetMaxRadius(std::size_t index);
-	void CalcAllCM(void);
+	// Calculates the area and centroid of every face and the volume and center of mass of the cells in a single pass over the faces
+	void CalcAllFaceGeometry(void);
+	// Sets the CM of the ghosts from the CM of the real cells
+	void CalcGhostCM(void)const;
+	// The lazy batches, the area and centroid of all of the faces, then the volume and CM of all of the cells
+	void CalcFaceGeometry(void)const;
+	void CalcCellGeometry(void)const;
+	void UpdateFaceGeometry(void)const;
+	void UpdateCellGeometry(void)const;
 	vector<std::pair<std::size_t, std::size_t> > SerialFindIntersections(void);
 #ifdef RICH_MPI
 	vector<std::pair<std::size_t, std::size_t> > FindIntersections(Tessellation3D const& tproc, bool recursive);
 	vector<Vector3D> CreateBoundaryPointsMPI(vector<std::pair<std::size_t, std::size_t> > const& to_duplicate,
 		Tessellation3D const& tproc, vector<vector<size_t> > &self_duplicate);
+	vector<Vector3D> CreateBoundaryPointsHilbert(vector<std::pair<Vector3D, Vector3D> > const& boxes, bool first_round,
+		vector<vector<size_t> > &self_duplicate);
 #endif
 	double CalcTetraRadiusCenter(std::size_t index);
-	vector<Vector3D> CreateBoundaryPoints(vector<std::pair<std::size_t, std::size_t> > const& to_duplicate);
+	// Calculates the circumcenters and radii of all of the tetras in blocks
+	void CalcAllTetraRadiusCenter(void);
+	// Mirrors the points near the box, seeds are the tetras where the walks of the ghosts start
+	vector<Vector3D> CreateBoundaryPoints(vector<std::pair<std::size_t, std::size_t> > const& to_duplicate,
+		vector<std::size_t> &seeds);
 	void BuildVoronoi(void);
+	// Fills the neighbor array from the faces of the cells
+	void BuildNeighborList(void);
+	// Adds the translated copies of the points near the box until the search finds no new ones
+	void CreatePeriodicPoints(void);
+	// Sets the CM of the periodic ghosts by translating the CM of their real cells
+	void CalcPeriodicCM(void)const;
 
 	Delaunay3D del_;
-	vector<vector<std::size_t> > PointTetras_; // The tetras containing each point
+	vector<std::size_t> point_tetras_temp_; // The tetras around the point that is checked, found by Delaunay3D::GetPointTetras
 	vector<double> R_; // The radius of the sphere of each tetra
 	vector<Vector3D> tetra_centers_;
 	// Voronoi Data
 	vector<vector<std::size_t> > FacesInCell_;
 	vector<vector<std::size_t> > PointsInFace_; // Right hand with regard to first neighbor
 	vector<std::pair<std::size_t, std::size_t> > FaceNeighbors_;
-	vector<Vector3D> CM_;
-	vector<double> volume_;
-	vector<double> area_;
+	mutable vector<Vector3D> CM_;
+	mutable vector<double> volume_;
+	mutable vector<double> area_;
+	mutable vector<Vector3D> face_cm_; // The area weighted centroid of each face
+	// The neighbors of all of the cells, the neighbors of cell i are between neighbor_offsets_[i] and neighbor_offsets_[i + 1]
+	vector<std::size_t> neighbor_offsets_, neighbor_list_;
 	vector<vector<std::size_t> > duplicated_points_;
 	vector<int> sentprocs_, duplicatedprocs_;
 	vector<vector<std::size_t> > sentpoints_, Nghost_;
 	vector<std::size_t> self_index_;
+	vector<std::size_t> periodic_sources_; // The real point of each periodic ghost, the ghosts start after the large tetra points
+	// Epoch stamped visited marks of the tproc faces and the cached faces of this rank, used in the ghost search
+	vector<std::size_t> visit_stamp_, rank_faces_;
+	std::size_t visit_epoch_;
+	double build_time_;
 	Voronoi3D();
 public:
 	Vector3D FaceCM(std::size_t index)const;
 
-	Voronoi3D(Vector3D const& ll, Vector3D const& ur);
+	/*!
+	\brief Class constructor
+	\param ll The lower left corner of the box
+	\param ur The upper right corner of the box
+	\param periodic True for periodic boundaries, false for reflective walls. Periodic boundaries are only supported in serial builds
+	*/
+	Voronoi3D(Vector3D const& ll, Vector3D const& ur, bool periodic = false);
+
+	/*!
+	\brief Sets the lazy mode, where Build only finds the faces and the neighbors. The areas and face centroids, and then the volumes and the CM, are calculated in a batch on their first access and kept until the next build.
+	The accessors may be called from several OpenMP threads, the first access calculates the batch once while the other threads wait. MPI builds always calculate everything, since the CM of the ghosts is exchanged during the build
+	\param lazy True for the lazy mode
+	*/
+	void SetLazyGeometry(bool lazy);
 
 	void output(std::string const& filename)const;
 
+	/*!
+	\brief Writes the triangulation, including the ghosts, and the processor bookkeeping so that the tessellation can be rebuilt without triangulating
+	\param filename The name of the file, every processor should write its own file
+	*/
+	void WriteCheckpoint(std::string const& filename)const;
+
+	/*!
+	\brief Rebuilds the tessellation from a checkpoint, skipping the triangulation and the ghost search, this is a collective call when running with MPI
+	\details The tessellation has to be constructed with the same periodicity as the one that wrote the checkpoint, otherwise an error is thrown
+	\param filename The name of the file written by WriteCheckpoint
+	*/
+	void BuildFromCheckpoint(std::string const& filename);
+
 	void Build(vector<Vector3D> const& points);
 
 #ifdef RICH_MPI
 	void Build(vector<Vector3D> const& points, Tessellation3D const& tproc);
+
+	/*!
+	\brief Builds the local tessellation when the domain is split by ranges of the Hilbert curve, this is a collective call
+	\param points The points of this processor, points owned by other processors are sent to them
+	\param hproc The partition of the domain
+	*/
+	void Build(vector<Vector3D> const& points, HilbertPartition3D const& hproc);
 #endif
 
 	std::size_t GetPointNo(void) const;
@@ -107,6 +185,8 @@ public:
 
 	vector<std::size_t> GetNeighbors(std::size_t index)const;
 
+	std::pair<NeighborIterator, NeighborIterator> GetNeighborRange(std::size_t index)const;
+
 	Tessellation3D* clone(void) const;
 
 	bool NearBoundary(std::size_t index) const;
@@ -121,6 +201,16 @@ public:
 
 	vector<Vector3D>& GetAllCM(void);
 
+	vector<Vector3D> const& GetAllCM(void)const;
+
+	vector<double> const& GetAllAreas(void)const;
+
+	vector<double> const& GetAllVolumes(void)const;
+
+	vector<std::pair<std::size_t, std::size_t> > const& GetAllFaceNeighbors(void)const;
+
+	void GetAllNormals(vector<Vector3D> &normals)const;
+
 	void GetNeighborNeighbors(vector<std::size_t> &result, std::size_t point)const;
 
 	Vector3D Normal(std::size_t faceindex)const;
@@ -129,6 +219,8 @@ public:
 
 	Vector3D CalcFaceVelocity(std::size_t index, Vector3D const& v0, Vector3D const& v1)const;
 
+	void CalcAllFaceVelocities(vector<Vector3D> const& velocities, vector<Vector3D> &face_velocities)const;
+
 	vector<Vector3D>const& GetFacePoints(void) const;
 
 	vector<std::size_t>const& GetPointsInFace(std::size_t index) const;
@@ -144,6 +236,39 @@ public:
 	vector<std::size_t> const& GetSelfIndex(void) const;
 
 	vector<vector<std::size_t> > const& GetGhostIndeces(void) const;
+
+	/*!
+	\brief Returns the wall time of the last call to Build, used for load balancing
+	\return The time in seconds
+	*/
+	double GetBuildTime(void) const;
+
+	/*!
+	\brief Returns the outer box
+	\return The lower left and upper right corners of the box
+	*/
+	std::pair<Vector3D, Vector3D> GetBoxCoordinates(void) const;
+
+	/*!
+	\brief Returns the real cell of a point, with periodic boundaries a ghost point is a translated copy of a real cell
+	\param index The index of the point
+	\return The index of the real cell, or index itself if the point is not a periodic ghost
+	*/
+	std::size_t GetOriginalIndex(std::size_t index) const;
+
+	/*!
+	\brief Renumbers the cells along the Hilbert curve and sorts the faces by their neighbors, so that loops over the faces access the cells in order. Call it after Build and before using the cell data.
+	With MPI the cells of this processor's own points stay before the cells of the received points, so GetSelfIndex keeps its meaning
+	\return The old index of every new cell, used to reorder the fields of the caller
+	*/
+	vector<std::size_t> Reorder(void);
+
+	/*!
+	\brief Calculates a single cell from the tetras around its point, without the face tables of the whole tessellation. The call is thread safe, so cells can be calculated in parallel
+	\param point The index of a real point
+	\param cell The geometry of the cell, its containers are reused
+	*/
+	void GetCell(std::size_t point, VoronoiCell &cell) const;
 };
 
 bool PointInPoly(Tessellation3D const& tess, Vector3D const& point, std::size_t index);
@@ -6,28 +6,10 @@
 #include <string>
 #include <fstream>
 #include "int2str.hpp"
+#include "PointReader3D.hpp"
 
 namespace
 {
-	vector<Vector3D> ReadPoints(std::string const& filename)
-	{
-		std::ifstream fh(filename.c_str(), std::ifstream::binary);
-		int npoints;
-		fh.read(reinterpret_cast<char*>(&npoints), sizeof(int));
-		vector<Vector3D> res(static_cast<size_t>(npoints));
-		double temp;
-		for (size_t i = 0; i<static_cast<size_t>(npoints); ++i)
-		{
-			fh.read(reinterpret_cast<char*>(&temp), sizeof(double));
-			res[i].x = temp;
-			fh.read(reinterpret_cast<char*>(&temp), sizeof(double));
-			res[i].y = temp;
-			fh.read(reinterpret_cast<char*>(&temp), sizeof(double));
-			res[i].z = temp;
-		}
-		return res;
-	}
-
 	bool myfunction(Vector3D i, Vector3D j)
 	{
 		return i.x < j.x;
@@ -86,12 +68,11 @@ int main(void)
 	//vector<Vector3D> points = RandSquare(np, Vector3D(-1, -1, -1), Vector3D(1, 1, 1));
 	//vector<Vector3D> points = cartesian_mesh(np,np,np, Vector3D(-1, -1, -1), Vector3D(1, 1, 1));
 	
-	vector<Vector3D> points;
+	vector<std::string> files;
 	for (int i = 0; i < 31; ++i)
-	{
-		vector<Vector3D> temp = ReadPoints("c:/sim_data/tess" +int2str(i)+".bin");
-		points.insert(points.end(), temp.begin(), temp.end());
-	}
+		files.push_back("c:/sim_data/tess" + int2str(i) + ".bin");
+	vector<Vector3D> points;
+	ReadPoints3D(files, points);
 	
 	
 	Delaunay3D tri;